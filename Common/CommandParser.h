@@ -0,0 +1,114 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// Incremental parser for the serial commands (nCCv<stop byte>), shared by both firmwares (header only).
+// Bytes are fed one at a time as they arrive, it never waits for more input.
+// Lines longer than the buffer are discarded up to the next stop byte.
+// A line may carry a batch of commands separated by CMD_SEPARATOR (e.g. 1SV?;1SI?;2SV?;2SI?<stop byte>).
+// Commands are split in place in the line buffer, nothing is allocated. See CommandTable.h for the dispatch.
+
+#define CMD_LINE_SIZE 128
+#define CMD_SEPARATOR ';'
+
+struct Command
+{
+    int source;             // 0 if invalid
+    uint16_t cmd;           // Two command characters (high byte first)
+    float value;            // -1 for queries (v = '?')
+    bool query;             // v = '?'
+    const char* arg;        // Raw value string (null terminated, valid until the next feed)
+};
+
+enum CommandStatus
+{
+    CMD_NONE,      // Nothing complete yet (or no more commands in the line)
+    CMD_READY,     // A line is complete (feed) / a command was parsed (next)
+    CMD_OVERFLOW,  // Line too long, discarded
+    CMD_MALFORMED  // Command too short, skipped
+};
+
+class CommandParser
+{
+public:
+    CommandParser(char stop) : stop(stop), len(0), pos(0), overflow(false), complete(false) {  }
+
+    // Returns CMD_READY once a full line was received
+    CommandStatus feed(uint8_t c)
+    {
+        // Start a new line after the previous one was handed out
+        if(complete)
+        {
+            len = 0;
+            pos = 0;
+            complete = false;
+        }
+
+        if(c == stop)
+        {
+            if(overflow)
+            {
+                len = 0;
+                overflow = false;
+                return CMD_OVERFLOW;
+            }
+
+            line[len] = '\0';
+            complete = true;
+            return CMD_READY;
+        }
+
+        // Ignore line feeds left between commands (hosts sending \r\n)
+        if(c == '\n' && len == 0)
+            return CMD_NONE;
+
+        // Keep room for the terminator, drop the rest of the line
+        if(len >= CMD_LINE_SIZE - 1)
+        {
+            overflow = true;
+            return CMD_NONE;
+        }
+
+        line[len++] = c;
+        return CMD_NONE;
+    }
+
+    // Iterates the commands of the last complete line, CMD_NONE when there are no more
+    CommandStatus next(Command& out)
+    {
+        if(!complete || pos >= len)
+            return CMD_NONE;
+
+        // Split in place, the separator becomes the terminator of this command
+        char* cmd = &line[pos];
+        char* end = (char*)memchr(cmd, CMD_SEPARATOR, len - pos);
+        uint8_t clen = end ? (end - cmd) : (len - pos);
+        if(end) *end = '\0';
+        pos += clen + 1;
+
+        if(clen < 4)
+            return CMD_MALFORMED;
+
+        out.source = (cmd[0] == '1' || cmd[0] == '2') ? cmd[0] - '0' : 0;
+        out.cmd = (cmd[1] << 8) | cmd[2];
+        out.arg = &cmd[3];
+        out.query = (cmd[3] == '?');
+        out.value = out.query ? -1.0f : strtof(&cmd[3], nullptr);
+        return CMD_READY;
+    }
+
+    // True if the last complete line holds more than one command
+    bool isBatch() const
+    {
+        return complete && memchr(line, CMD_SEPARATOR, len) != nullptr;
+    }
+
+private:
+    char stop;
+    char line[CMD_LINE_SIZE];
+    uint8_t len;
+    uint8_t pos;
+    bool overflow;
+    bool complete;
+};
@@ -0,0 +1,140 @@
+#pragma once
+#include <cstdint>
+#include "CommandParser.h"
+
+// Table driven dispatch of the parsed commands (CommandParser.h), shared by both firmwares (header only, C++14).
+// Each command is described once (code, argument type, set and get handlers) in a constexpr list, in any order.
+// makeCommandTable() sorts the list by code at compile time, lookups are then a binary search in flash :
+//
+//   static constexpr CommandDesc MyCommandList[] = {
+//       { CMD_CODE('S', 'V'), CMD_ARG_INT, 0, &setVoltage, &getVoltage },
+//       ...
+//   };
+//   static constexpr CommandTable<CMD_COUNT(MyCommandList)> MyCommands = makeCommandTable(MyCommandList);
+//   static_assert(MyCommands.unique(), "Duplicated command code");
+//
+// dispatchCommand() checks the source and the argument before calling the handler, the caller reports the errors.
+
+#define CMD_CODE(a, b) (uint16_t)(((uint8_t)(a) << 8) | (uint8_t)(b))
+#define CMD_COUNT(list) (int)(sizeof(list) / sizeof((list)[0]))
+
+enum CommandArg : uint8_t
+{
+    CMD_ARG_NONE  = 0,  // Value ignored
+    CMD_ARG_INT   = 1,
+    CMD_ARG_FLOAT = 2,
+    CMD_ARG_TEXT  = 3   // Handler parses Command::arg itself (lists)
+};
+
+enum CommandFlags : uint8_t
+{
+    CMD_FLAG_GLOBAL = 0x01  // No source needed (n is don't care)
+};
+
+typedef void (*CommandHandler)(const Command& c);
+
+struct CommandDesc
+{
+    uint16_t code;
+    CommandArg arg;
+    uint8_t flags;
+    CommandHandler set;     // v given, nullptr if the command can only be read
+    CommandHandler get;     // v = '?', nullptr if the command can only be set
+};
+
+enum DispatchStatus
+{
+    DISPATCH_OK,
+    DISPATCH_UNKNOWN,       // Code not in the table
+    DISPATCH_NO_SOURCE,     // Per source command without a valid source
+    DISPATCH_READ_ONLY,     // Set of a command without set handler
+    DISPATCH_WRITE_ONLY,    // Query of a command without get handler
+    DISPATCH_BAD_ARG        // Value is not a number (int / float commands)
+};
+
+template<int N>
+struct CommandTable
+{
+    CommandDesc entries[N];
+
+    static constexpr int size() { return N; }
+
+    constexpr bool unique() const
+    {
+        for(int i = 1; i < N; i++)
+        {
+            if(entries[i].code == entries[i - 1].code) return false;
+        }
+        return true;
+    }
+
+    // Binary search, nullptr if not found
+    const CommandDesc* find(uint16_t code) const
+    {
+        int lo = 0;
+        int hi = N - 1;
+        while(lo <= hi)
+        {
+            int mid = (lo + hi) / 2;
+            if(entries[mid].code == code) return &entries[mid];
+            if(entries[mid].code < code) lo = mid + 1;
+            else                         hi = mid - 1;
+        }
+        return nullptr;
+    }
+};
+
+// Insertion sort by code, runs in the compiler
+template<int N>
+constexpr CommandTable<N> makeCommandTable(const CommandDesc (&list)[N])
+{
+    CommandTable<N> table{};
+    for(int i = 0; i < N; i++)
+    {
+        CommandDesc d = list[i];
+        int j = i;
+        while(j > 0 && table.entries[j - 1].code > d.code)
+        {
+            table.entries[j] = table.entries[j - 1];
+            j--;
+        }
+        table.entries[j] = d;
+    }
+    return table;
+}
+
+// True if arg starts like a number (strtof would take it)
+inline bool commandIsNumber(const char* arg)
+{
+    if(*arg == '+' || *arg == '-') arg++;
+    if(*arg == '.') arg++;
+    return *arg >= '0' && *arg <= '9';
+}
+
+template<int N>
+DispatchStatus dispatchCommand(const CommandTable<N>& table, const Command& c)
+{
+    const CommandDesc* d = table.find(c.cmd);
+    if(!d)
+        return DISPATCH_UNKNOWN;
+
+    if(c.source == 0 && !(d->flags & CMD_FLAG_GLOBAL))
+        return DISPATCH_NO_SOURCE;
+
+    if(c.query)
+    {
+        if(!d->get) return DISPATCH_WRITE_ONLY;
+        d->get(c);
+        return DISPATCH_OK;
+    }
+
+    if(!d->set)
+        return DISPATCH_READ_ONLY;
+
+    // Binary frames carry numbers without text (arg is null)
+    if((d->arg == CMD_ARG_INT || d->arg == CMD_ARG_FLOAT) && c.arg && !commandIsNumber(c.arg))
+        return DISPATCH_BAD_ARG;
+
+    d->set(c);
+    return DISPATCH_OK;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Compile-time lookup tables, shared by both firmwares (header only, C++14).
+// makeTable<T, N>(f) fills entry i with f(i), f being a constexpr function or a literal functor with a constexpr operator().
+// Declare the result static constexpr : the table is generated by the compiler and lives in flash, nothing runs at boot.
+//
+//   constexpr uint8_t square(int i) { return i * i; }
+//   static constexpr ConstTable<uint8_t, 16> Squares = makeTable<uint8_t, 16>(square);
+
+template<typename T, int N>
+struct ConstTable
+{
+    T data[N];
+
+    constexpr const T& operator[](int i) const { return data[i]; }
+    static constexpr int size() { return N; }
+};
+
+template<typename T, int N, typename F>
+constexpr ConstTable<T, N> makeTable(F f)
+{
+    ConstTable<T, N> table{};
+    for(int i = 0; i < N; i++)
+    {
+        table.data[i] = f(i);
+    }
+    return table;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Command line and exit code handling shared by the host checks and benchmarks of both firmwares (sim/ folders only).
+// Every tool takes --name value options, writes its results as JSON (stdout or a file) and exits with
+// SIM_EXIT_FAILED when a check fails, so CTest and CI scripts only look at the exit code.
+//
+//   const SimOption Options[] = { { "--iterations", SIM_OPT_INT, &iterations, "N" } };
+//   if(!simParseArgs(argc, argv, Options)) return SIM_EXIT_USAGE;
+//   ...
+//   return simFinish(out, failed, "Fixed point path differs by more than %.1f", tolerance);
+
+#define SIM_EXIT_OK 0
+#define SIM_EXIT_USAGE 1
+#define SIM_EXIT_FAILED 2
+
+enum SimOptionType
+{
+    SIM_OPT_INT,        // int
+    SIM_OPT_UINT,       // unsigned
+    SIM_OPT_FLOAT,      // float
+    SIM_OPT_DOUBLE,     // double
+    SIM_OPT_TEXT,       // const char*, points into argv
+    SIM_OPT_FLAG        // bool, set when present (takes no value)
+};
+
+struct SimOption
+{
+    const char* name;   // With the dashes, e.g. "--iterations"
+    SimOptionType type;
+    void* value;
+    const char* help;   // Value placeholder in the usage line
+};
+
+inline void simUsage(const char* program, const SimOption* options, int count)
+{
+    fprintf(stderr, "Usage : %s", program);
+    for(int i = 0; i < count; i++)
+    {
+        if(options[i].type == SIM_OPT_FLAG) fprintf(stderr, " [%s]", options[i].name);
+        else                                fprintf(stderr, " [%s %s]", options[i].name, options[i].help);
+    }
+    fprintf(stderr, "\n");
+}
+
+// Fills the option values from argv, returns false after printing the usage on an unknown option or a missing value
+inline bool simParseArgs(int argc, char** argv, const SimOption* options, int count)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const SimOption* o = nullptr;
+        for(int j = 0; j < count; j++)
+        {
+            if(!strcmp(argv[i], options[j].name)) o = &options[j];
+        }
+
+        if(!o || (o->type != SIM_OPT_FLAG && i + 1 >= argc))
+        {
+            simUsage(argv[0], options, count);
+            return false;
+        }
+
+        switch(o->type)
+        {
+            case SIM_OPT_INT:    *(int*)o->value = atoi(argv[++i]); break;
+            case SIM_OPT_UINT:   *(unsigned*)o->value = strtoul(argv[++i], nullptr, 10); break;
+            case SIM_OPT_FLOAT:  *(float*)o->value = atof(argv[++i]); break;
+            case SIM_OPT_DOUBLE: *(double*)o->value = atof(argv[++i]); break;
+            case SIM_OPT_TEXT:   *(const char**)o->value = argv[++i]; break;
+            case SIM_OPT_FLAG:   *(bool*)o->value = true; break;
+        }
+    }
+    return true;
+}
+
+template<int N>
+bool simParseArgs(int argc, char** argv, const SimOption (&options)[N])
+{
+    return simParseArgs(argc, argv, options, N);
+}
+
+// JSON output : stdout, or path if given. nullptr after printing the error
+inline FILE* simOpenOutput(const char* path)
+{
+    FILE* out = path ? fopen(path, "w") : stdout;
+    if(!out) perror(path);
+    return out;
+}
+
+// Flushes (and closes) the output, prints why the run failed on stderr and returns the exit code
+inline int simFinish(FILE* out, bool failed, const char* reason, ...)
+{
+    fflush(out);
+    if(out != stdout) fclose(out);
+
+    if(failed)
+    {
+        va_list args;
+        va_start(args, reason);
+        vfprintf(stderr, reason, args);
+        va_end(args);
+        fprintf(stderr, "\n");
+    }
+    return failed ? SIM_EXIT_FAILED : SIM_EXIT_OK;
+}
@@ -0,0 +1,158 @@
+#include "Acquisition.h"
+#include "us_ticker_api.h"
+
+// The DMA interrupt has no context argument
+static Acquisition* instance = nullptr;
+
+#define DMA_FLAGS_STREAM0 (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0)
+
+Acquisition::Acquisition(PinName i1, PinName v1, PinName i2, PinName v2) : scan_us(0), t_sample(0)
+{
+    const PinName pins[ACQ_NUM_CHANNELS] = { i1, v1, i2, v2 };
+
+    MBED_ASSERT(instance == nullptr);
+    instance = this;
+
+    for(int i = 0; i < ACQ_NUM_CHANNELS; i++)
+    {
+        // Only to set the pins to analog, enable the ADC clock and find the input, start() takes over ADC1
+        analogin_t adc;
+        analogin_init(&adc, pins[i]);
+        MBED_ASSERT(adc.handle.Instance == ADC1);
+        channel[i] = adc.channel;
+
+        scan[i] = 0;
+        last[i] = 0;
+        filter[i].configure(FILTER_AVERAGE, FILTER_DEFAULT_AVERAGE, ACQ_RATE_HZ);
+    }
+}
+
+void Acquisition::start()
+{
+    scan_us = (uint32_t)((uint64_t)ACQ_SCAN_CYCLES * 4 * 1000000 / HAL_RCC_GetPCLK2Freq());
+
+    // ADC1 : scan of the channels in order, one DMA request per conversion, started by TIM2 TRGO
+    ADC1->CR2 = 0;
+    ADC->CCR = (ADC->CCR & ~ADC_CCR_ADCPRE) | ADC_CLOCK_SYNC_PCLK_DIV4;
+    ADC1->CR1 = ADC_CR1_SCAN;
+    ADC1->SMPR1 = 0;
+    ADC1->SMPR2 = 0;
+    ADC1->SQR1 = (ACQ_NUM_CHANNELS - 1) << ADC_SQR1_L_Pos;
+    ADC1->SQR2 = 0;
+    ADC1->SQR3 = 0;
+    for(int i = 0; i < ACQ_NUM_CHANNELS; i++)
+    {
+        uint32_t ch = channel[i];
+        if(ch >= 10) ADC1->SMPR1 |= ACQ_SAMPLE_TIME << (3 * (ch - 10));
+        else         ADC1->SMPR2 |= ACQ_SAMPLE_TIME << (3 * ch);
+        ADC1->SQR3 |= ch << (5 * i);
+    }
+    ADC1->SR = 0;
+    ADC1->CR2 = ADC_CR2_DMA | ADC_CR2_DDS | ADC_EXTERNALTRIGCONV_T2_TRGO | ADC_EXTERNALTRIGCONVEDGE_RISING | ADC_CR2_ADON;
+
+    // DMA2 stream 0 channel 0 (ADC1) : circular over one scan, interrupt after the last channel
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    DMA2_Stream0->CR &= ~DMA_SxCR_EN;
+    while(DMA2_Stream0->CR & DMA_SxCR_EN);
+    DMA2->LIFCR = DMA_FLAGS_STREAM0;
+    DMA2_Stream0->PAR = (uint32_t)&ADC1->DR;
+    DMA2_Stream0->M0AR = (uint32_t)scan;
+    DMA2_Stream0->NDTR = ACQ_NUM_CHANNELS;
+    DMA2_Stream0->FCR = 0;
+    DMA2_Stream0->CR = DMA_SxCR_PL_1 | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0 | DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_TCIE;
+    DMA2_Stream0->CR |= DMA_SxCR_EN;
+
+    NVIC_SetVector(DMA2_Stream0_IRQn, (uint32_t)&Acquisition::dmaIrq);
+    NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+    // TIM2 : 1 MHz count, update event on TRGO every sample period
+    __HAL_RCC_TIM2_CLK_ENABLE();
+    uint32_t tim_clock = HAL_RCC_GetPCLK1Freq();
+    if(RCC->CFGR & RCC_CFGR_PPRE1_2) tim_clock *= 2;    // APB1 timers run at twice PCLK1 when it is divided
+
+    TIM2->CR1 = 0;
+    TIM2->PSC = tim_clock / 1000000 - 1;
+    TIM2->ARR = 1000000 / ACQ_RATE_HZ - 1;
+    TIM2->CR2 = TIM_TRGO_UPDATE;
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CR1 = TIM_CR1_CEN;
+
+    // Stop mode would halt TIM2 and the ADC
+    sleep_manager_lock_deep_sleep();
+}
+
+void Acquisition::stop()
+{
+    // The scan in progress still completes
+    TIM2->CR1 = 0;
+    sleep_manager_unlock_deep_sleep();
+}
+
+float Acquisition::read(int ch) const
+{
+    return filter[ch].output() * (3.3f / 65535.0f);
+}
+
+uint16_t Acquisition::filtered(int ch) const
+{
+    return filter[ch].output();
+}
+
+uint16_t Acquisition::raw(int ch) const
+{
+    return last[ch];
+}
+
+uint32_t Acquisition::sampleTime() const
+{
+    return t_sample;
+}
+
+void Acquisition::attach(Callback<void()> cb)
+{
+    on_sample = cb;
+}
+
+bool Acquisition::setFilter(int ch, FilterType type, float param)
+{
+    // Prepare the new filter outside the ISR and swap it in one go
+    Filter f;
+    if(!f.configure(type, param, ACQ_RATE_HZ))
+        return false;
+
+    core_util_critical_section_enter();
+    // Carry on from the current output instead of starting over from 0
+    if(filter[ch].isSeeded()) f.seed(filter[ch].output());
+    filter[ch] = f;
+    core_util_critical_section_exit();
+    return true;
+}
+
+const Filter& Acquisition::getFilter(int ch) const
+{
+    return filter[ch];
+}
+
+void Acquisition::dmaIrq()
+{
+    uint32_t status = DMA2->LISR;
+    DMA2->LIFCR = DMA_FLAGS_STREAM0;
+
+    if(status & DMA_LISR_TCIF0) instance->sample();
+}
+
+void Acquisition::sample()
+{
+    // The interrupt comes at the end of the scan
+    t_sample = us_ticker_read() - scan_us;
+
+    for(int i = 0; i < ACQ_NUM_CHANNELS; i++)
+    {
+        // 12 bit to the 0 - 65535 scale of analogin_read_u16, full scale stays full scale
+        uint16_t x = scan[i];
+        last[i] = (x << 4) | (x >> 8);
+        filter[i].process(last[i]);
+    }
+
+    if(on_sample) on_sample();
+}
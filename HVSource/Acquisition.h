@@ -0,0 +1,64 @@
+#pragma once
+#include "mbed.h"
+#include "analogin_api.h"
+#include "HAL.h"
+
+// Background acquisition of the four HV monitor channels (STM32F446, ADC1).
+// TIM2 triggers a scan of all channels at ACQ_RATE_HZ, the ADC converts them in sequence and DMA2 stream 0 copies
+// the results, the CPU never waits for a conversion. The DMA transfer complete interrupt feeds each channel through
+// a configurable filter (see Filter.h), consumers get the latest filtered value in O(1).
+// Only the last raw sample of each channel is kept, for the protection.
+
+// Channel indexes and rate are in HAL.h
+
+// ADC clock PCLK2 / 4 (22.5 MHz at 180 MHz), 144 + 12 cycles per channel : a scan takes ~28 us of the 200 us period.
+// The long sampling time suits the monitor dividers, it costs no CPU time.
+#define ACQ_SAMPLE_TIME ADC_SAMPLETIME_144CYCLES
+#define ACQ_SCAN_CYCLES ((144 + 12) * ACQ_NUM_CHANNELS)
+
+class Acquisition : public AdcHal
+{
+public:
+    // The pins must all be on ADC1 (PA_0, PA_1, PC_1, PC_0 on this board), a single instance
+    Acquisition(PinName i1, PinName v1, PinName i2, PinName v2);
+
+    void start() override;
+    void stop();
+
+    // Latest filtered value of channel ch [V at the ADC pin]
+    float read(int ch) const override;
+
+    // Latest filtered sample of channel ch [0 - 65535]
+    uint16_t filtered(int ch) const override;
+
+    // Last sample of channel ch, before the filter [0 - 65535]
+    uint16_t raw(int ch) const override;
+
+    // us_ticker time at the start of the last scan
+    uint32_t sampleTime() const override;
+
+    // Called from the ISR after every scan of all channels (keep it short)
+    void attach(Callback<void()> cb) override;
+
+    // Swaps the filter of channel ch, returns false if the parameter is invalid for the type
+    bool setFilter(int ch, FilterType type, float param) override;
+    const Filter& getFilter(int ch) const override;
+
+private:
+    static void dmaIrq();
+    void sample();
+
+private:
+    // ADC1 inputs, in scan order
+    uint8_t channel[ACQ_NUM_CHANNELS];
+
+    // Written by the DMA, 12 bit right aligned
+    volatile uint16_t scan[ACQ_NUM_CHANNELS];
+
+    Filter filter[ACQ_NUM_CHANNELS];
+    volatile uint16_t last[ACQ_NUM_CHANNELS];
+
+    uint32_t scan_us;   // Trigger -> last conversion
+    volatile uint32_t t_sample;
+    Callback<void()> on_sample;
+};
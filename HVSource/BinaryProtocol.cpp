@@ -0,0 +1,76 @@
+#include "BinaryProtocol.h"
+#include <cstring>
+
+BinaryProtocol::BinaryProtocol() : len(0), expected(0), crc_errors(0)
+{
+
+}
+
+uint16_t BinaryProtocol::crc16(const uint8_t* data, int len, uint16_t crc)
+{
+    for(int i = 0; i < len; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for(int b = 0; b < 8; b++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+bool BinaryProtocol::feed(uint8_t c, BinaryFrame& out)
+{
+    // Hunt for the sync byte
+    if(len == 0 && c != BIN_SYNC)
+        return false;
+
+    buffer[len++] = c;
+
+    if(len == 2)
+    {
+        if(buffer[1] > BIN_MAX_PAYLOAD)
+        {
+            len = 0;
+            return false;
+        }
+        expected = BIN_HEADER_SIZE + buffer[1] + 2;
+    }
+
+    if(len < 2 || len < expected)
+        return false;
+
+    len = 0;
+
+    int data_len = expected - 3; // Without the sync and the crc
+    uint16_t crc = buffer[expected - 2] | (buffer[expected - 1] << 8);
+    if(crc16(&buffer[1], data_len) != crc)
+    {
+        crc_errors++;
+        return false;
+    }
+
+    out.len = buffer[1];
+    out.seq = buffer[2];
+    out.source = buffer[3];
+    out.cmd = buffer[4] | (buffer[5] << 8);
+    memcpy(out.payload, &buffer[BIN_HEADER_SIZE], out.len);
+    return true;
+}
+
+int BinaryProtocol::encode(const BinaryFrame& frame, uint8_t* buffer)
+{
+    buffer[0] = BIN_SYNC;
+    buffer[1] = frame.len;
+    buffer[2] = frame.seq;
+    buffer[3] = frame.source;
+    buffer[4] = frame.cmd & 0xFF;
+    buffer[5] = frame.cmd >> 8;
+    memcpy(&buffer[BIN_HEADER_SIZE], frame.payload, frame.len);
+
+    int n = BIN_HEADER_SIZE + frame.len;
+    uint16_t crc = crc16(&buffer[1], n - 1);
+    buffer[n++] = crc & 0xFF;
+    buffer[n++] = crc >> 8;
+    return n;
+}
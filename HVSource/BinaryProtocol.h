@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+
+// Binary framed protocol, an alternative to the ASCII commands for high rate polling.
+// Every frame is little-endian with the layout :
+//   [0xA5] [len] [seq] [source] [cmd lo] [cmd hi] [payload (len bytes)] [crc lo] [crc hi]
+// The CRC16 (CCITT, init 0xFFFF) covers everything from len to the end of the payload.
+// cmd uses the same two character codes as the ASCII table (e.g. 'S' 'V' -> 0x5356).
+//
+// Requests : empty payload - query, otherwise [type] [value]
+//            BIN_TYPE_FLOAT followed by a float32, or BIN_TYPE_TEXT followed by the text (no terminator)
+// Replies  : same seq/source/cmd as the request, payload = [status] [fields]
+//            status bits : BIN_STATUS_ERROR - the command failed (see EE), BIN_STATUS_TRUNCATED - fields were dropped
+//            each field is [type] [value] : BIN_TYPE_INT + int32, BIN_TYPE_FLOAT + float32,
+//            BIN_TYPE_TEXT + [length] + text. Fields that don't fit in the payload are dropped whole.
+
+#define BIN_SYNC 0xA5
+#define BIN_HEADER_SIZE 6
+#define BIN_MAX_PAYLOAD 128
+#define BIN_MAX_FRAME (BIN_HEADER_SIZE + BIN_MAX_PAYLOAD + 2)
+
+#define BIN_STATUS_OK 0x00
+#define BIN_STATUS_ERROR 0x01
+#define BIN_STATUS_TRUNCATED 0x02
+
+#define BIN_TYPE_INT 0
+#define BIN_TYPE_FLOAT 1
+#define BIN_TYPE_TEXT 2
+
+struct BinaryFrame
+{
+    uint8_t len;
+    uint8_t seq;
+    uint8_t source;
+    uint16_t cmd;
+    uint8_t payload[BIN_MAX_PAYLOAD];
+};
+
+class BinaryProtocol
+{
+public:
+    BinaryProtocol();
+
+    // Feed one received byte, returns true when out holds a complete and valid frame
+    bool feed(uint8_t c, BinaryFrame& out);
+
+    // Writes the frame into buffer (at least BIN_MAX_FRAME bytes), returns the number of bytes
+    static int encode(const BinaryFrame& frame, uint8_t* buffer);
+
+    static uint16_t crc16(const uint8_t* data, int len, uint16_t crc = 0xFFFF);
+
+    // Frames dropped due to a bad CRC
+    uint32_t errors() const { return crc_errors; }
+
+private:
+    uint8_t buffer[BIN_MAX_FRAME];
+    int len;
+    int expected;
+    uint32_t crc_errors;
+};
@@ -0,0 +1,235 @@
+#include "Calibration.h"
+#include "BinaryProtocol.h"
+#include "HAL.h"
+#include "../Common/ConstTable.h"
+#include <cstddef>
+#include <cstring>
+
+// Factory fits (the same for both sources), two points reproduce the previous linear conversions exactly
+// Per unit V_SET fits : 27 : 0.0009094 * V[mV] - 0.004561 / 28 : 0.0009071 * V[mV] - 0.002949
+// Per unit V_MON fits : 27 : 1096.500 * Vmon + 1.081400    / 28 : 1099.000 * Vmon + 1.025200
+static constexpr float DefaultTables[CAL_NUM_TABLES][2][2] = {
+    { { 0.0f, -0.003413f }, { 2400.0f, 0.9095f * 2400.0f - 0.003413f } },    // V_SET
+    { { 0.0f, 0.721925f },  { 3.3f, 1096.475f * 3.3f + 0.721925f } },         // V_MON
+    { { 0.0f, 0.0f },       { 500.0f, 500.0f * 1000.0f / 253.0f } },          // I_SET
+    { { 0.0f, 0.0f },       { 3.3f, 3.3f * 253.0f } }                         // I_MON
+};
+
+// Units of the fixed point tables, { x scale, y scale } from the float table units
+static constexpr float FixedScales[CAL_NUM_TABLES][2] = {
+    { 1000.0f, (float)DAC_RESOLUTION / DAC_VREF_MV },     // V_SET : V -> mV, mV -> DAC code
+    { ADC_FULL_SCALE / ADC_VREF, 1000.0f },               // V_MON : V at pin -> counts, V -> mV
+    { 1000.0f, (float)DAC_RESOLUTION / DAC_VREF_MV },     // I_SET : uA -> nA, mV -> DAC code
+    { ADC_FULL_SCALE / ADC_VREF, 1000.0f }                // I_MON : V at pin -> counts, uA -> nA
+};
+
+// Fixed point copies of the factory tables, generated by the compiler
+struct FactoryFixed
+{
+    constexpr CalTableQ operator()(int t) const
+    {
+        return CalTableQ(DefaultTables[t], 2, FixedScales[t][0], FixedScales[t][1]);
+    }
+};
+
+static constexpr ConstTable<CalTableQ, CAL_NUM_TABLES> FactoryFixedTables = makeTable<CalTableQ, CAL_NUM_TABLES>(FactoryFixed());
+
+CalTable::CalTable() : n(0)
+{
+    const float x[2] = { 0.0f, 1.0f };
+    set(x, x, 2);
+}
+
+bool CalTable::set(const float* x, const float* y, int n)
+{
+    if(n < 2 || n > CAL_MAX_POINTS)
+        return false;
+
+    for(int i = 1; i < n; i++)
+    {
+        if(!(x[i] > x[i - 1]) || !(y[i] > y[i - 1]))
+            return false;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        px[i] = x[i];
+        py[i] = y[i];
+    }
+
+    for(int i = 0; i < n - 1; i++)
+    {
+        slope[i] = (py[i + 1] - py[i]) / (px[i + 1] - px[i]);
+        inv_slope[i] = 1.0f / slope[i];
+    }
+
+    this->n = n;
+    return true;
+}
+
+int CalTable::segment(const float* p, int n, float v)
+{
+    // Last segment whose start is <= v, the end segments also cover the values out of range
+    int lo = 0;
+    int hi = n - 2;
+    while(lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if(v >= p[mid]) lo = mid;
+        else            hi = mid - 1;
+    }
+    return lo;
+}
+
+float CalTable::apply(float x) const
+{
+    int i = segment(px, n, x);
+    return py[i] + slope[i] * (x - px[i]);
+}
+
+float CalTable::inverse(float y) const
+{
+    int i = segment(py, n, y);
+    return px[i] + inv_slope[i] * (y - py[i]);
+}
+
+void CalTableQ::build(const CalTable& table, float x_scale, float y_scale)
+{
+    float points[CAL_MAX_POINTS][2];
+    for(int i = 0; i < table.size(); i++)
+    {
+        points[i][0] = table.x(i);
+        points[i][1] = table.y(i);
+    }
+    *this = CalTableQ(points, table.size(), x_scale, y_scale);
+}
+
+int32_t CalTableQ::apply(int32_t x) const
+{
+    // Same segment search as CalTable
+    int lo = 0;
+    int hi = n - 2;
+    while(lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if(x >= px[mid]) lo = mid;
+        else             hi = mid - 1;
+    }
+
+    int64_t y = py[lo] + slope[lo] * (x - px[lo]);
+    return (int32_t)((y + (1LL << 31)) >> 32);
+}
+
+Calibration::Calibration()
+{
+    for(int s = 1; s <= CAL_NUM_SOURCES; s++)
+    {
+        defaults(s);
+    }
+}
+
+bool Calibration::setPoint(int source, CalTableId id, int index, float x, float y)
+{
+    if(source < 1 || source > CAL_NUM_SOURCES || id < 0 || id >= CAL_NUM_TABLES || index < 0 || index >= CAL_MAX_POINTS)
+        return false;
+
+    stage[source - 1][id][index][0] = x;
+    stage[source - 1][id][index][1] = y;
+    return true;
+}
+
+bool Calibration::apply(int source, CalTableId id, int n)
+{
+    if(source < 1 || source > CAL_NUM_SOURCES || id < 0 || id >= CAL_NUM_TABLES || n < 2 || n > CAL_MAX_POINTS)
+        return false;
+
+    float x[CAL_MAX_POINTS];
+    float y[CAL_MAX_POINTS];
+    for(int i = 0; i < n; i++)
+    {
+        x[i] = stage[source - 1][id][i][0];
+        y[i] = stage[source - 1][id][i][1];
+    }
+
+    CalTable table;
+    if(!table.set(x, y, n))
+        return false;
+
+    setTable(source, id, table);
+
+    stored[source - 1] = false;
+    return true;
+}
+
+void Calibration::defaults(int source)
+{
+    for(int t = 0; t < CAL_NUM_TABLES; t++)
+    {
+        const float x[2] = { DefaultTables[t][0][0], DefaultTables[t][1][0] };
+        const float y[2] = { DefaultTables[t][0][1], DefaultTables[t][1][1] };
+        tables[source - 1][t].set(x, y, 2);
+        fixed_tables[source - 1][t] = FactoryFixedTables[t];
+
+        for(int i = 0; i < CAL_MAX_POINTS; i++)
+        {
+            stage[source - 1][t][i][0] = 0.0f;
+            stage[source - 1][t][i][1] = 0.0f;
+        }
+    }
+    stored[source - 1] = false;
+}
+
+void Calibration::toRecord(int source, CalRecord& record)
+{
+    memset(&record, 0, sizeof(record));
+    record.magic = CAL_MAGIC;
+
+    for(int t = 0; t < CAL_NUM_TABLES; t++)
+    {
+        const CalTable& table = tables[source - 1][t];
+        record.n[t] = table.size();
+        for(int i = 0; i < table.size(); i++)
+        {
+            record.points[t][i][0] = table.x(i);
+            record.points[t][i][1] = table.y(i);
+        }
+    }
+
+    record.crc = BinaryProtocol::crc16((const uint8_t*)&record, offsetof(CalRecord, crc));
+}
+
+bool Calibration::fromRecord(int source, const CalRecord& record)
+{
+    if(record.magic != CAL_MAGIC || record.crc != BinaryProtocol::crc16((const uint8_t*)&record, offsetof(CalRecord, crc)))
+        return false;
+
+    // Validate every table before touching the current ones
+    CalTable loaded[CAL_NUM_TABLES];
+    for(int t = 0; t < CAL_NUM_TABLES; t++)
+    {
+        float x[CAL_MAX_POINTS];
+        float y[CAL_MAX_POINTS];
+        int n = record.n[t];
+        for(int i = 0; i < n && i < CAL_MAX_POINTS; i++)
+        {
+            x[i] = record.points[t][i][0];
+            y[i] = record.points[t][i][1];
+        }
+
+        if(!loaded[t].set(x, y, n))
+            return false;
+    }
+
+    for(int t = 0; t < CAL_NUM_TABLES; t++)
+    {
+        setTable(source, t, loaded[t]);
+    }
+    stored[source - 1] = true;
+    return true;
+}
+
+void Calibration::setTable(int source, int id, const CalTable& table)
+{
+    tables[source - 1][id] = table;
+    fixed_tables[source - 1][id].build(table, FixedScales[id][0], FixedScales[id][1]);
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <cstdint>
+
+// Per source calibration of the HV conversions, as multi-point piecewise linear tables.
+// Each source has one table per direction :
+//   CAL_V_SET - voltage setpoint [V]         -> DAC voltage reference [mV]
+//   CAL_V_MON - voltage monitor [V at pin]   -> output voltage [V]
+//   CAL_I_SET - current limit [uA]           -> DAC current reference [mV]
+//   CAL_I_MON - current monitor [V at pin]   -> output current [uA]
+// The segment slopes are precomputed, a lookup is a binary search over the points plus one multiply-add.
+// Points must be strictly increasing in both x and y, inputs out of the table range extrapolate the end segments.
+// This class holds no hardware references, storing the tables is up to the caller (see CalRecord).
+//
+// Every table also has a fixed point copy (CalTableQ) working on integers, used by the HV_FIXED_POINT conversion path :
+//   CAL_V_SET - voltage setpoint [mV]         -> DAC code
+//   CAL_V_MON - voltage monitor [ADC counts]  -> output voltage [mV]
+//   CAL_I_SET - current limit [nA]            -> DAC code
+//   CAL_I_MON - current monitor [ADC counts]  -> output current [nA]
+
+#define CAL_MAX_POINTS 12
+#define CAL_NUM_SOURCES 2
+#define CAL_MAGIC 0x48564331 // "HVC1"
+
+enum CalTableId
+{
+    CAL_V_SET = 0,
+    CAL_V_MON,
+    CAL_I_SET,
+    CAL_I_MON,
+    CAL_NUM_TABLES
+};
+
+class CalTable
+{
+public:
+    CalTable();
+
+    // Returns false if there are less than 2 points, too many or they are not strictly increasing (table left untouched)
+    bool set(const float* x, const float* y, int n);
+
+    float apply(float x) const;
+    float inverse(float y) const;
+
+    int size() const { return n; }
+    float x(int i) const { return px[i]; }
+    float y(int i) const { return py[i]; }
+
+private:
+    static int segment(const float* p, int n, float v);
+
+private:
+    int n;
+    float px[CAL_MAX_POINTS];
+    float py[CAL_MAX_POINTS];
+    float slope[CAL_MAX_POINTS - 1];     // dy/dx of each segment
+    float inv_slope[CAL_MAX_POINTS - 1]; // dx/dy of each segment
+};
+
+// Integer version of a CalTable, x and y are scaled to integer units when built.
+// The y values and slopes are Q32.32, so a lookup is a binary search plus one 64 bit multiply-add and a shift.
+// Can be built at compile time from constant points (the factory tables are).
+class CalTableQ
+{
+public:
+    constexpr CalTableQ() : n(0), px{}, py{}, slope{} {  }
+
+    // From n { x, y } points in the CalTable units, x and y are multiplied by x_scale and y_scale
+    constexpr CalTableQ(const float (*points)[2], int n, float x_scale, float y_scale) : n(n), px{}, py{}, slope{}
+    {
+        // Worked out in double for the full Q32 precision, this only runs when a table changes (or in the compiler)
+        const double one = 4294967296.0;
+
+        for(int i = 0; i < n; i++)
+        {
+            px[i] = (int32_t)roundToInt(points[i][0] * (double)x_scale);
+
+            // Points closer than one x unit would make an empty segment
+            if(i > 0 && px[i] <= px[i - 1]) px[i] = px[i - 1] + 1;
+
+            // The point moved to an integer x, take y from the float table there (steep tables would be off by a segment slope)
+            double x = px[i] / (double)x_scale;
+            int s = i < n - 1 ? i : n - 2;
+            if(i > 0 && x < points[i][0]) s = i - 1;
+            double slope_xy = ((double)points[s + 1][1] - points[s][1]) / ((double)points[s + 1][0] - points[s][0]);
+            py[i] = roundToInt((points[s][1] + slope_xy * (x - points[s][0])) * y_scale * one);
+        }
+
+        for(int i = 0; i < n - 1; i++)
+        {
+            slope[i] = roundToInt((double)(py[i + 1] - py[i]) / (px[i + 1] - px[i]));
+        }
+    }
+
+    // Copies table, x and y are multiplied by x_scale and y_scale
+    void build(const CalTable& table, float x_scale, float y_scale);
+
+    // Rounded to the nearest integer
+    int32_t apply(int32_t x) const;
+
+private:
+    static constexpr int64_t roundToInt(double v)
+    {
+        return v < 0.0 ? -(int64_t)(0.5 - v) : (int64_t)(v + 0.5);
+    }
+
+private:
+    int n;
+    int32_t px[CAL_MAX_POINTS];
+    int64_t py[CAL_MAX_POINTS];          // Q32.32
+    int64_t slope[CAL_MAX_POINTS - 1];   // Q32.32, y units per x unit
+};
+
+// Flash image of the tables of one source
+struct CalRecord
+{
+    uint32_t magic;
+    uint8_t n[CAL_NUM_TABLES];
+    float points[CAL_NUM_TABLES][CAL_MAX_POINTS][2];
+    uint16_t crc;
+};
+
+class Calibration
+{
+public:
+    Calibration();
+
+    const CalTable& table(int source, CalTableId id) const { return tables[source - 1][id]; }
+    const CalTableQ& fixed(int source, CalTableId id) const { return fixed_tables[source - 1][id]; }
+
+    // Uploads are staged point by point, then applied as a whole table
+    bool setPoint(int source, CalTableId id, int index, float x, float y);
+    bool apply(int source, CalTableId id, int n);
+
+    // Restores the factory fits of source
+    void defaults(int source);
+
+    // True if the tables of source match the stored record (loaded or saved, not changed since)
+    bool isStored(int source) const { return stored[source - 1]; }
+    void markStored(int source) { stored[source - 1] = true; }
+
+    void toRecord(int source, CalRecord& record);
+    bool fromRecord(int source, const CalRecord& record);
+
+private:
+    void setTable(int source, int id, const CalTable& table);
+
+private:
+    CalTable tables[CAL_NUM_SOURCES][CAL_NUM_TABLES];
+    CalTableQ fixed_tables[CAL_NUM_SOURCES][CAL_NUM_TABLES];
+    float stage[CAL_NUM_SOURCES][CAL_NUM_TABLES][CAL_MAX_POINTS][2];
+    bool stored[CAL_NUM_SOURCES];
+};
@@ -0,0 +1,1796 @@
+#include "Controller.h"
+#include "RampEngine.h"
+#include "Sequencer.h"
+#include "Protection.h"
+#include "../Common/CommandTable.h"
+#include "BinaryProtocol.h"
+#include "TxQueue.h"
+#include "Telemetry.h"
+#include "FlightRecorder.h"
+#include "EventLog.h"
+#include "Profiler.h"
+#include "LCDDisplay.h"
+#include "Calibration.h"
+#include "ThreadLoad.h"
+#include "Snapshot.h"
+#include "SourceState.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// HV source control logic, independent of the board (see HAL.h).
+// Built for the target by main.cpp and for Linux by sim/.
+
+// Threads, highest priority first :
+// - protection (realtime) : zeroes the DAC after an over-current trip (see Protection.h), the check itself runs in the acquisition ISR
+// - control (high)        : voltage ramps and profiles, the only periodic DAC writer
+// - comms (normal)        : serial commands and telemetry, woken by the serial port
+// - ui (below normal)     : LCD refresh and status LED
+// The state of both sources is published by the acquisition ISR as a single snapshot (source_state), the threads only read that.
+// Everything else they share is either single words (LED mailbox, setpoint mirrors) or guarded by dac_mutex (ramps, calibration).
+// Errors and events go to a lock-free queue (events, see EventLog.h) that any thread or ISR can post to, the comms thread reads it.
+
+// Firmware features:
+// - DAC Voltage Ramp (non blocking, per source slew rate)
+// - Target V
+// - Target Max I
+// - Display Target V and Target I
+// - Display Real V and Real I
+// - Get/Set all values via Serial COM.
+// - Get error messages via Serial COM.
+// - Enable/Disable sources via Serial COM.
+
+// Serial Commands Formating : sCCv\n 
+// (s = HV source numbered in the back [1,2], CC = Two commands characters (see command table below), v = command specific value) 
+
+// Examples 
+// Powering HV Source 1 On                   - 1PO1\n
+// Setting max current on Source 2 to 150 uA - 2SI150.0\n
+// Setting target voltage on Source 2 to 2kV - 2SV2000\n
+// Get last error string                     - 1EE0\n
+// Pop the oldest queued error                - 0ED?\n
+// Setting ramp slew rate on Source 1 to 100 V/s - 1SR100\n
+// Setting IIR monitor filter on Source 2         - 2FT2\n
+// Batch, one reply for all commands              - 1SV?;1SI?;2SV?;2SI?\n
+// Read all monitors from a single snapshot       - 0RA?\n
+// Switch to the binary framed protocol           - 0BM1\n (see BinaryProtocol.h)
+// Stream all monitors at 100 Hz                  - 0TS100\n
+// Upload V_SET calibration point 1 of source 1   - 1CP0,1,1200,1091.3\n
+// Thread stack and CPU use                       - 0TH?\n
+
+#define SERIAL_STOP_BYTE '\r'
+
+// Board drivers, set once by controllerInit()
+static HVHardware hw;
+
+// Over-current trip, checked on every acquisition sample
+Protection protection;
+
+// Monitor streaming, decimated from the acquisition samples
+Telemetry telemetry(ACQ_RATE_HZ);
+
+// History of the last seconds, frozen on the first trip (see FlightRecorder.h)
+FlightRecorder recorder;
+
+// Dump in progress (RD), only used by the comms thread. 7 entries per frame
+#define REC_DUMP_ENTRIES ((BIN_MAX_PAYLOAD - 2) / (int)sizeof(RecordEntry))
+bool dump_active = false;
+uint32_t dump_next = 0;
+
+// Everything sent to the host goes through here (in order), see serialWrite()
+TxQueue tx;
+
+// Errors and events, kept numeric until the host asks for them
+EventLog events;
+
+// Command errors, only used by the comms thread. The source of the command being handled is posted with them
+uint32_t error_count = 0;
+int command_source = 0;
+
+void setError(ErrorCode code, EventArg a0 = 0, EventArg a1 = 0)
+{
+    events.post(code, command_source, a0, a1);
+    error_count++;
+}
+
+// Current limits (DAC A and C), the voltage setpoints live in the ramp engine
+// Only used by the comms thread
+float dac_value2 = 0.0f;
+float dac_value4 = 0.0f;
+
+const float DefaultSlewRate = 2400.0f; // [V/s] Full scale in 1 second
+const float MaxSlewRate = 24000.0f;    // [V/s] Full scale in 100 milliseconds
+
+#define CONTROL_STACK_SIZE 2048
+#define COMMS_STACK_SIZE 4096
+#define UI_STACK_SIZE 2048
+
+// Voltage ramps for both sources, advanced by the ramp thread
+RampEngine ramp(DefaultSlewRate);
+
+// Voltage profiles, they drive the ramps (same lock, same thread)
+Sequencer sequencer;
+
+Thread ramp_thread(osPriorityHigh, CONTROL_STACK_SIZE, nullptr, "control");
+
+// CPU use of the controller threads, see threadStats()
+ThreadLoad control_load;
+ThreadLoad comms_load;
+ThreadLoad ui_load;
+Ticker ramp_ticker;
+EventFlags ramp_flags;
+
+#define RAMP_FLAG_START 0x01
+#define RAMP_FLAG_TICK  0x02
+#define RAMP_PERIOD 250us // 4 kHz DAC update rate while ramping
+
+// Guards the ramp engine and keeps ramp updates and DAC writes in order
+Mutex dac_mutex;
+
+// Free running time base for the ramps [us]
+Timer uptime;
+
+// Published after every acquisition sample, see SourceState.h
+Snapshot<SourceState> source_state;
+
+// Setpoints copied into every snapshot by the acquisition ISR, single words so the ISR never sees half an update
+// The ramp ones are written under dac_mutex (rampPublish()), the current limits by the comms thread
+struct SetpointMirror
+{
+    std::atomic<float> target_v[2];
+    std::atomic<float> level_v[2];
+    std::atomic<float> limit_ua[2];
+    std::atomic<uint8_t> ramping;   // Bit 0 - source 1
+};
+
+SetpointMirror setpoints;
+
+// Call with dac_mutex held, after any change to the ramps
+void rampPublish()
+{
+    uint8_t ramping = 0;
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        setpoints.target_v[i].store(ramp.getTarget(i + 1), std::memory_order_relaxed);
+        setpoints.level_v[i].store(ramp.getLevel(i + 1), std::memory_order_relaxed);
+        if(ramp.isActive(i + 1)) ramping |= (1 << i);
+    }
+    setpoints.ramping.store(ramping, std::memory_order_relaxed);
+}
+
+// Per source conversion tables, changed under dac_mutex (by the comms thread), the other threads read them under it too
+Calibration cal;
+
+// Monitor channels of each source (current, voltage)
+const int SourceChannels[2][2] = { { ACQ_I1, ACQ_V1 }, { ACQ_I2, ACQ_V2 } };
+
+void set_dac_ref(float ref, char dac)
+{
+    PROFILE_SCOPE(PROF_DAC_WRITE);
+    hw.dac->write(dac - 'A', ref);
+}
+
+// This is from legacy code (UA Student) and should not be used. Unless for testing purposes only, or when disabling.
+// Use the dac voltage ramp mode instead.
+void dac(float ref1, float ref2, float ref3, float ref4)
+{
+    //////////////////////////////////////////////////
+    // Provide reference voltage to comparators (DAC):
+
+    // DAC Reset High, Lock low
+    //     digitalWrite(RESET,HIGH);  // HIGH - não faz reset; LOW - põe todos os registos internos a 0V.
+    //     digitalWrite(LOCK, LOW);
+    const float ref[DAC_NUM_CHANNELS] = { ref1, ref2, ref3, ref4 };
+    hw.dac->writeBatch(ref, DAC_MASK_ALL);
+}
+
+void set_dac_current(float i1, float i2)
+{
+    PROFILE_SCOPE(PROF_DAC_WRITE);
+    const float ref[DAC_NUM_CHANNELS] = { i1, 0.0f, i2, 0.0f };
+    hw.dac->writeBatch(ref, DAC_MASK_A | DAC_MASK_C);
+}
+
+bool checkV(float ef)
+{
+    return ef < 2400.0f && ef >= 0.0f;
+}
+
+bool checkI(float ef)
+{
+    return ef < 500.0f && ef >= 0.0f;
+}
+
+bool checkSlew(float ef)
+{
+    return ef <= MaxSlewRate && ef > 0.0f;
+}
+
+// Conversions go through the calibration tables of each source (see Calibration.h)
+// Voltage setpoint [V] -> DAC reference [mV]
+float convertV(float valorV, int source)
+{
+    return cal.table(source, CAL_V_SET).apply(valorV);
+}
+
+// Voltage monitor [V at the ADC pin] -> output voltage [V]
+float convertVmon(float Vmon, int source)
+{
+    return cal.table(source, CAL_V_MON).apply(Vmon);
+}
+
+// Current limit [uA] -> DAC reference [mV]
+float convertI(float ab, int source)
+{
+    return cal.table(source, CAL_I_SET).apply(ab);
+}
+
+// Current monitor [V at the ADC pin] -> output current [uA]
+float convertImon(float Imon, int source)
+{
+    return cal.table(source, CAL_I_MON).apply(Imon);
+}
+
+// Hot path conversions, straight from raw ADC counts and to DAC codes.
+// With HV_FIXED_POINT they only use integer arithmetic (fixed point copies of the tables), otherwise the float tables above.
+// Voltage monitor [ADC counts] -> output voltage [mV]
+int32_t monitorV(uint16_t raw, int source)
+{
+#ifdef HV_FIXED_POINT
+    return cal.fixed(source, CAL_V_MON).apply(raw);
+#else
+    return lroundf(convertVmon(raw * (ADC_VREF / ADC_FULL_SCALE), source) * 1000.0f);
+#endif
+}
+
+// Current monitor [ADC counts] -> output current [nA]
+int32_t monitorI(uint16_t raw, int source)
+{
+#ifdef HV_FIXED_POINT
+    return cal.fixed(source, CAL_I_MON).apply(raw);
+#else
+    return lroundf(convertImon(raw * (ADC_VREF / ADC_FULL_SCALE), source) * 1000.0f);
+#endif
+}
+
+// Voltage setpoint [mV] -> DAC code
+uint16_t voltageCode(int32_t mv, int source)
+{
+#ifdef HV_FIXED_POINT
+    return DacHal::clampCode(cal.fixed(source, CAL_V_SET).apply(mv));
+#else
+    return DacHal::toCode(convertV(mv * 0.001f, source));
+#endif
+}
+
+const char RampDAC[RAMP_NUM_SOURCES] = { 'B', 'D' };
+
+uint64_t uptime_us()
+{
+    return uptime.elapsed_time().count();
+}
+
+// Ramps source from the current level to v [V], this returns immediately (the ramp thread does the work)
+void set_dac_voltage_sloped(float v, int source)
+{
+    dac_mutex.lock();
+    ramp.start(source, v, uptime_us());
+    rampPublish();
+    dac_mutex.unlock();
+    ramp_flags.set(RAMP_FLAG_START);
+}
+
+// Stops any ramp on source and drops its DAC voltage reference to 0 V
+void set_dac_voltage_zero(int source)
+{
+    dac_mutex.lock();
+    ramp.reset(source, 0.0f);
+    rampPublish();
+    set_dac_ref(0.0f, RampDAC[source - 1]);
+    dac_mutex.unlock();
+}
+
+// Call with dac_mutex held. Ends the profile of source, if one is running or paused, and reports it
+void sequenceStop(int source, SeqState reason)
+{
+    uint8_t segment = sequencer.progress(source, 0).segment;
+    if(sequencer.stop(source, ramp, reason))
+    {
+        events.post(ERR_SEQ_STOPPED, source, source, segment);
+        ramp_flags.set(RAMP_FLAG_START); // Drop the wait for the end of its hold
+    }
+}
+
+void rampTick()
+{
+    ramp_flags.set(RAMP_FLAG_TICK);
+}
+
+void rampThread()
+{
+    Kernel::Clock::duration_u32 wait = Kernel::wait_for_u32_forever;
+    while(true)
+    {
+        // Sleep until there is something to ramp, or until a profile phase ends (holds are not ticked)
+        ramp_flags.wait_any_for(RAMP_FLAG_START, wait);
+
+        // The RTOS tick is 1 ms, pace the updates with a ticker to go faster than that
+        ramp_ticker.attach(&rampTick, RAMP_PERIOD);
+
+        bool active = true;
+        uint64_t next_event = 0;
+        while(active)
+        {
+            control_load.begin();
+
+            // Both sources are advanced and written in the same pass
+            uint16_t code[DAC_NUM_CHANNELS] = { 0, 0, 0, 0 };
+            uint8_t mask = 0;
+
+            dac_mutex.lock();
+            {
+                PROFILE_SCOPE(PROF_RAMP);
+                uint64_t now = uptime_us();
+                sequencer.update(ramp, now);
+                uint8_t changed = ramp.update(now);
+                for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+                {
+                    if(changed & (1 << i))
+                    {
+                        int ch = RampDAC[i] - 'A';
+                        code[ch] = voltageCode((int32_t)(ramp.getLevel(i + 1) * 1000.0f), i + 1);
+                        mask |= (1 << ch);
+                    }
+                }
+                if(mask)
+                {
+                    PROFILE_SCOPE(PROF_DAC_WRITE);
+                    hw.dac->writeCodes(code, mask);
+                }
+                rampPublish();
+                active = ramp.anyActive();
+                next_event = sequencer.nextEvent();
+            }
+            dac_mutex.unlock();
+
+            control_load.end();
+            if(active) ramp_flags.wait_any(RAMP_FLAG_TICK);
+        }
+
+        ramp_ticker.detach();
+
+        // Segment times come from the schedule, so waking up to 1 ms late does not delay the profile
+        wait = Kernel::wait_for_u32_forever;
+        if(next_event)
+        {
+            uint64_t now = uptime_us();
+            wait = std::chrono::milliseconds(next_event > now ? (next_event - now + 999) / 1000 : 0);
+        }
+    }
+}
+
+// Both return the filtered monitors of a snapshot (no ADC conversions are done here)
+float averageI(const SourceState& state, int source)
+{
+    return monitorI(state.mon[SourceChannels[source - 1][0]], source) * 0.001f;
+}
+
+float averageV(const SourceState& state, int source)
+{
+    return monitorV(state.mon[SourceChannels[source - 1][1]], source) * 0.001f;
+}
+
+// Trip threshold of a source in the averageI() scale, from its current limit DAC value
+float tripLimit(float dac_value)
+{
+    return dac_value - 10;
+}
+
+// The protection compares raw samples, so the threshold goes back through the current monitor calibration
+void updateTripLimit(int source)
+{
+    float limit = tripLimit(source == 1 ? dac_value2 : dac_value4);
+    protection.setLimit(source, cal.table(source, CAL_I_MON).inverse(limit));
+}
+
+// Converts the current limit of a source through its calibration and writes it, with the matching trip threshold.
+// Called when the limit or the I_SET / I_MON tables change.
+void applyCurrentLimit(int source)
+{
+    float dac_value = convertI(setpoints.limit_ua[source - 1].load(std::memory_order_relaxed), source);
+    if(source == 1) dac_value2 = dac_value;
+    else            dac_value4 = dac_value;
+
+    updateTripLimit(source);
+    set_dac_current(dac_value2, dac_value4);
+}
+
+// Status LED colour, set by the comms and protection threads and shown by the UI thread
+enum LedColor
+{
+    LED_NONE = 0, // Left as the boot signal left it
+    LED_RED,
+    LED_BLUE
+};
+
+volatile int led_color = LED_NONE;
+
+// Wakes the comms thread when serial data is received
+EventFlags comms_flags;
+
+#define COMMS_FLAG_RX    0x01
+#define COMMS_FLAG_ALL   0x01
+#define COMMS_POLL_MS 1 // Telemetry and pending replies are served at least this often
+
+// Called from the protection thread, the protection ISR already disabled the source
+void onTrip(int source)
+{
+    // Stop the ramp first, otherwise the ramp thread would write the DAC back up
+    const float ref[DAC_NUM_CHANNELS] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    dac_mutex.lock();
+    ramp.reset(source, 0.0f);
+    sequenceStop(source, SEQ_TRIPPED);
+    rampPublish();
+    {
+        PROFILE_SCOPE(PROF_DAC_WRITE);
+        hw.dac->writeBatch(ref, source == 1 ? (DAC_MASK_A | DAC_MASK_B) : (DAC_MASK_C | DAC_MASK_D));
+    }
+    dac_mutex.unlock();
+
+    // The protection ISR already posted the trip event
+    led_color = LED_RED;
+}
+
+// Nextion commands go through their own queue, only changed widgets are sent (see LCDDisplay.h)
+TxQueue lcd_tx;
+LCDDisplay display(&lcd_tx);
+
+// Sends as much queued LCD data as the port takes right now, never blocks
+void lcdDrain()
+{
+    const uint8_t* data;
+    int n;
+
+    while((n = lcd_tx.peek(&data)) > 0)
+    {
+        int sent = hw.lcd->write(data, n);
+        if(sent <= 0)
+            break;
+        lcd_tx.pop(sent);
+    }
+}
+
+void updateLCDRealValues(int v1, int v2, float i1, float i2)
+{
+    display.set(LCD_V1R, v1);
+    display.set(LCD_V2R, v2);
+    display.set(LCD_I1R, (int)(i1 * 100));
+    display.set(LCD_I2R, (int)(i2 * 100));
+}
+
+void updateLCDTargetValues(int v1, int v2, float i1, float i2)
+{
+    display.set(LCD_V1T, v1);
+    display.set(LCD_V2T, v2);
+    display.set(LCD_I1T, (int)(i1 * 100));
+    display.set(LCD_I2T, (int)(i2 * 100));
+}
+
+enum ProtocolMode
+{
+    PROTOCOL_ASCII = 0,
+    PROTOCOL_BINARY = 1
+};
+
+ProtocolMode protocol_mode = PROTOCOL_ASCII;
+ProtocolMode next_protocol_mode = PROTOCOL_ASCII; // Switched once the current reply is out
+
+// Replies are accumulated and sent once per command line (a batch gets a single reply) or binary frame
+// ASCII : fields are formatted and separated by ',' / Binary : fields are packed little-endian after a type byte
+char reply[512];
+int reply_len = 0;
+int reply_fields = 0;
+bool reply_truncated = false; // Binary : a field didn't fit in the frame, the following ones are dropped as well
+
+void replyRaw(const void* data, int len)
+{
+    if(len > (int)sizeof(reply) - reply_len) len = sizeof(reply) - reply_len;
+    memcpy(reply + reply_len, data, len);
+    reply_len += len;
+}
+
+void replyField()
+{
+    if(protocol_mode == PROTOCOL_ASCII && reply_fields++ > 0) replyRaw(",", 1);
+}
+
+// Binary : true if a field of len bytes still fits in the reply frame
+bool replyFits(int len)
+{
+    if(!reply_truncated && reply_len + len <= BIN_MAX_PAYLOAD)
+        return true;
+
+    reply_truncated = true;
+    return false;
+}
+
+void replyBinary(uint8_t type, const void* data, int len)
+{
+    if(!replyFits(1 + len))
+        return;
+
+    replyRaw(&type, 1);
+    replyRaw(data, len);
+}
+
+void replyInt(int32_t v)
+{
+    replyField();
+    if(protocol_mode == PROTOCOL_ASCII)
+    {
+        char data[16];
+        replyRaw(data, sprintf(data, "%ld", (long)v));
+    }
+    else
+    {
+        replyBinary(BIN_TYPE_INT, &v, sizeof(v));
+    }
+}
+
+void replyFloat(float v, int decimals = 2)
+{
+    replyField();
+    if(protocol_mode == PROTOCOL_ASCII)
+    {
+        char data[48];
+        replyRaw(data, snprintf(data, sizeof(data), "%.*f", decimals, v));
+    }
+    else
+    {
+        replyBinary(BIN_TYPE_FLOAT, &v, sizeof(v));
+    }
+}
+
+void replyText(const char* s)
+{
+    replyField();
+    int len = strlen(s);
+    if(protocol_mode == PROTOCOL_ASCII)
+    {
+        replyRaw(s, len);
+    }
+    else
+    {
+        // [BIN_TYPE_TEXT] [length] [text]
+        if(len > 255) len = 255;
+        if(!replyFits(2 + len))
+            return;
+
+        uint8_t header[2] = { BIN_TYPE_TEXT, (uint8_t)len };
+        replyRaw(header, sizeof(header));
+        replyRaw(s, len);
+    }
+}
+
+// Sends as much queued data as the port takes right now, never blocks
+void serialDrain()
+{
+    const uint8_t* data;
+    int n;
+
+    while((n = tx.peek(&data)) > 0)
+    {
+        int sent = hw.serial->write(data, n);
+        if(sent <= 0)
+            break;
+        tx.pop(sent);
+    }
+}
+
+// Queues data that must reach the host (replies), waits for room instead of dropping
+void serialWrite(const void* data, int len)
+{
+    while(tx.free() < len)
+    {
+        serialDrain();
+        if(tx.free() < len) ThisThread::sleep_for(1ms);
+    }
+    tx.push(data, len);
+    serialDrain();
+}
+
+void replySend()
+{
+    if(reply_len > 0)
+    {
+        replyRaw("\r\n", 2);
+        serialWrite(reply, reply_len);
+    }
+    reply_len = 0;
+    reply_fields = 0;
+}
+
+void powerOnOff(int source, int value)
+{
+    if(value >= 0)
+    {
+        if(source == 1 || source == 2)
+        {
+            dac_mutex.lock();
+            sequenceStop(source, SEQ_ABORTED);
+            dac_mutex.unlock();
+        }
+
+        switch(source)
+        {
+            case 1:
+                // Always start (or end) at 0 V, the ramp brings the source up to its target
+                // A trip zeroes the current limit as well, so restore it and re-arm the protection
+                if(value) { set_dac_voltage_zero(1); set_dac_current(dac_value2, dac_value4); protection.clear(1); hw.en->write(1, 1); set_dac_voltage_sloped(ramp.getTarget(1), 1); }
+                else      { hw.en->write(1, 0); set_dac_voltage_zero(1); }
+                break;
+            case 2:
+                if(value) { set_dac_voltage_zero(2); set_dac_current(dac_value2, dac_value4); protection.clear(2); hw.en->write(2, 1); set_dac_voltage_sloped(ramp.getTarget(2), 2); }
+                else      { hw.en->write(2, 0); set_dac_voltage_zero(2); }
+                break;
+            default:
+                break;
+        }
+        
+        led_color = (hw.en->read(1) || hw.en->read(2)) ? LED_BLUE : LED_RED;
+    }
+    else
+    {
+        switch(source)
+        {
+            case 1:
+            {
+                replyInt(hw.en->read(1));
+            }
+            break;
+            case 2:
+            {
+                replyInt(hw.en->read(2));
+            }
+            break;
+            default:
+                break;
+        }
+    }
+}
+
+void setVoltage(int source, int value)
+{
+    if(value >= 0)
+    {
+        if(!checkV(value))
+        {
+            setError(ERR_VOLTAGE_RANGE, value);
+            return;
+        }
+        if(source == 1 || source == 2)
+        {
+            // The host takes over from a running profile
+            dac_mutex.lock();
+            sequenceStop(source, SEQ_ABORTED);
+            dac_mutex.unlock();
+        }
+        switch(source)
+        {
+            case 1:
+                if(hw.en->read(1)) set_dac_voltage_sloped(value, 1);
+                else    { dac_mutex.lock(); ramp.setTarget(1, value); rampPublish(); dac_mutex.unlock(); }
+                break;
+            case 2:
+                if(hw.en->read(2)) set_dac_voltage_sloped(value, 2);
+                else    { dac_mutex.lock(); ramp.setTarget(2, value); rampPublish(); dac_mutex.unlock(); }
+                break;
+            default:
+                break;
+        }
+    }
+    else
+    {
+        switch(source)
+        {
+            case 1:
+            {
+                SourceState state;
+                source_state.read(state);
+                replyFloat(averageV(state, 1));
+            }
+            break;
+            case 2:
+            {
+                SourceState state;
+                source_state.read(state);
+                replyFloat(averageV(state, 2));
+            }
+            break;
+            default:
+                break;
+        }
+    }
+}
+
+void setCurrent(int source, float value)
+{
+    if(value >= 0)
+    {
+        if(!checkI(value))
+        {
+            setError(ERR_CURRENT_RANGE, value);
+            return;
+        }
+        setpoints.limit_ua[source - 1].store(value, std::memory_order_relaxed);
+        applyCurrentLimit(source);
+    }
+    else
+    {
+        switch(source)
+        {
+            case 1:
+            {
+                SourceState state;
+                source_state.read(state);
+                replyFloat(averageI(state, 1));
+            }
+            break;
+            case 2:
+            {
+                SourceState state;
+                source_state.read(state);
+                replyFloat(averageI(state, 2));
+            }
+            break;
+            default:
+                break;
+        }
+    }
+}
+
+void setSlewRate(int source, float value)
+{
+    if(source != 1 && source != 2)
+        return;
+
+    if(value >= 0)
+    {
+        if(!checkSlew(value))
+        {
+            setError(ERR_SLEW_RANGE, value, MaxSlewRate);
+            return;
+        }
+        dac_mutex.lock();
+        ramp.setSlew(source, value);
+        dac_mutex.unlock();
+    }
+    else
+    {
+        replyFloat(ramp.getSlew(source));
+    }
+}
+
+void setFilterType(int source, int value)
+{
+    if(source != 1 && source != 2)
+        return;
+
+    const int* ch = SourceChannels[source - 1];
+    if(value >= 0)
+    {
+        FilterType type = (FilterType)value;
+        float param = Filter::defaultParam(type);
+        if(!hw.adc->setFilter(ch[0], type, param) || !hw.adc->setFilter(ch[1], type, param))
+        {
+            setError(ERR_FILTER_TYPE, value);
+        }
+    }
+    else
+    {
+        replyInt(hw.adc->getFilter(ch[0]).getType());
+    }
+}
+
+void setFilterParam(int source, float value)
+{
+    if(source != 1 && source != 2)
+        return;
+
+    const int* ch = SourceChannels[source - 1];
+    if(value >= 0)
+    {
+        FilterType type = hw.adc->getFilter(ch[0]).getType();
+        if(!hw.adc->setFilter(ch[0], type, value) || !hw.adc->setFilter(ch[1], type, value))
+        {
+            setError(ERR_FILTER_PARAM, value, type);
+        }
+    }
+    else
+    {
+        replyFloat(hw.adc->getFilter(ch[0]).getParam());
+    }
+}
+
+void tripState(int source, int value)
+{
+    if(source != 1 && source != 2)
+        return;
+
+    if(value == 0)
+    {
+        protection.clear(source);
+    }
+    else if(value < 0)
+    {
+        replyInt(protection.isTripped(source));
+    }
+}
+
+void tripLatency(int source, int value)
+{
+    if(source != 1 && source != 2)
+        return;
+
+    if(value == 0)
+    {
+        protection.resetStats(source);
+    }
+    else if(value < 0)
+    {
+        const TripStats& stats = protection.getStats(source);
+        replyInt(stats.count);
+        replyInt(stats.en_worst_us);
+        replyInt(stats.dac_worst_us);
+    }
+}
+
+// V1, I1, V2, I2, enable states and trip flags, all from the same instant
+void readAll()
+{
+    SourceState state;
+    source_state.read(state);
+
+    replyFloat(averageV(state, 1));
+    replyFloat(averageI(state, 1));
+    replyFloat(averageV(state, 2));
+    replyFloat(averageI(state, 2));
+    replyInt(state.en[0]);
+    replyInt(state.en[1]);
+    replyInt(state.tripped[0]);
+    replyInt(state.tripped[1]);
+}
+
+void setProtocolMode(int value)
+{
+    if(value == PROTOCOL_ASCII || value == PROTOCOL_BINARY)
+    {
+        next_protocol_mode = (ProtocolMode)value;
+    }
+    else if(value < 0)
+    {
+        replyInt(protocol_mode);
+    }
+    else
+    {
+        setError(ERR_PROTOCOL_MODE, value);
+    }
+}
+
+void setTelemetryRate(float value)
+{
+    if(value >= 0)
+    {
+        if(!telemetry.setRate(value))
+        {
+            setError(ERR_TELEMETRY_RATE, value, TELEMETRY_MAX_RATE);
+        }
+    }
+    else
+    {
+        replyFloat(telemetry.getRate());
+        replyInt(telemetry.dropped() + tx.dropped());
+    }
+}
+
+void setTelemetryMask(int value)
+{
+    if(value >= 0)
+    {
+        if(value > TELEMETRY_ALL)
+        {
+            setError(ERR_TELEMETRY_MASK, value, TELEMETRY_ALL);
+            return;
+        }
+        telemetry.setMask(value);
+    }
+    else
+    {
+        replyInt(telemetry.getMask());
+    }
+}
+
+void setLCDRate(int value)
+{
+    if(value >= 0)
+    {
+        if(!display.setRate(value))
+        {
+            setError(ERR_LCD_RATE, value, LCD_MAX_RATE);
+        }
+    }
+    else
+    {
+        replyInt(display.getRate());
+    }
+}
+
+// Calibration records are stored per source
+const char* CalKeys[CAL_NUM_SOURCES] = { "/kv/hv_cal1", "/kv/hv_cal2" };
+
+// Loads the stored tables of source, keeps the factory fits if there are none
+void calLoad(int source)
+{
+    CalRecord record;
+    if(!hw.storage || !hw.storage->load(CalKeys[source - 1], &record, sizeof(record)))
+        return;
+
+    dac_mutex.lock();
+    bool ok = cal.fromRecord(source, record);
+    dac_mutex.unlock();
+
+    if(!ok)
+    {
+        events.post(ERR_CAL_CORRUPTED, source, source);
+    }
+}
+
+void calPoint(int source, const char* arg)
+{
+    int table, index;
+    float x, y;
+
+    if(!arg || sscanf(arg, "%d,%d,%f,%f", &table, &index, &x, &y) != 4 || !cal.setPoint(source, (CalTableId)table, index, x, y))
+    {
+        setError(ERR_CAL_POINT, CAL_NUM_TABLES - 1, CAL_MAX_POINTS - 1);
+    }
+}
+
+void calApply(int source, const char* arg)
+{
+    int table, n;
+
+    if(!arg || sscanf(arg, "%d,%d", &table, &n) != 2)
+    {
+        setError(ERR_CAL_APPLY);
+        return;
+    }
+
+    dac_mutex.lock();
+    bool ok = cal.apply(source, (CalTableId)table, n);
+    dac_mutex.unlock();
+
+    if(!ok)
+    {
+        setError(ERR_CAL_REJECTED, table, CAL_MAX_POINTS);
+        return;
+    }
+
+    if(table == CAL_I_SET || table == CAL_I_MON) applyCurrentLimit(source);
+}
+
+void calGet(int source, int value)
+{
+    if(value < 0 || value >= CAL_NUM_TABLES)
+    {
+        setError(ERR_CAL_TABLE, value, CAL_NUM_TABLES - 1);
+        return;
+    }
+
+    const CalTable& table = cal.table(source, (CalTableId)value);
+    replyInt(table.size());
+    for(int i = 0; i < table.size(); i++)
+    {
+        replyFloat(table.x(i), 6);
+        replyFloat(table.y(i), 6);
+    }
+}
+
+void calStore(int source, int value)
+{
+    if(value == 1)
+    {
+        CalRecord record;
+        cal.toRecord(source, record);
+        if(!hw.storage || !hw.storage->store(CalKeys[source - 1], &record, sizeof(record)))
+        {
+            setError(ERR_CAL_STORE, source);
+            return;
+        }
+        cal.markStored(source);
+    }
+    else if(value == 0)
+    {
+        dac_mutex.lock();
+        cal.defaults(source);
+        dac_mutex.unlock();
+        applyCurrentLimit(source);
+    }
+    else if(value < 0)
+    {
+        replyInt(cal.isStored(source));
+    }
+}
+
+#define STATS_MAX_THREADS 12
+
+struct ThreadLoadEntry
+{
+    const char* name;
+    ThreadLoad* load;
+};
+
+// Threads whose CPU use is measured, by the name they are created with
+const ThreadLoadEntry ThreadLoads[] = { { "control", &control_load }, { "comms", &comms_load }, { "ui", &ui_load } };
+
+// Per thread : name, priority, stack size, max stack used [bytes], CPU [%] (-1 if not measured), then the system idle time [%]
+// The stack and idle figures need the platform stats enabled (see mbed_app.json)
+void threadStats(int value)
+{
+    if(value == 0)
+    {
+        for(const ThreadLoadEntry& e : ThreadLoads) e.load->reset(uptime_us());
+        return;
+    }
+    if(value > 0)
+    {
+        setError(ERR_THREAD_STATS, value);
+        return;
+    }
+
+    static mbed_stats_thread_t stats[STATS_MAX_THREADS];
+    int n = mbed_stats_thread_get_each(stats, STATS_MAX_THREADS);
+    for(int i = 0; i < n; i++)
+    {
+        float cpu = -1.0f;
+        for(const ThreadLoadEntry& e : ThreadLoads)
+        {
+            if(stats[i].name && !strcmp(stats[i].name, e.name)) cpu = e.load->percent(uptime_us());
+        }
+
+        replyText(stats[i].name ? stats[i].name : "?");
+        replyInt(stats[i].priority);
+        replyInt(stats[i].stack_size);
+        replyInt(stats[i].stack_size - stats[i].stack_space);
+        replyFloat(cpu, 1);
+    }
+
+    mbed_stats_cpu_t cpu;
+    mbed_stats_cpu_get(&cpu);
+    replyFloat(cpu.uptime ? cpu.idle_time * 100.0f / cpu.uptime : 0.0f, 1);
+}
+
+// Recorder state : state (0 armed, 1 triggered, 2 frozen), entries held, trigger index (-1 none), divider, post trigger [%]
+// 0 rearms (clears the buffer, ends a dump in progress), 1 freezes it right away
+void recorderControl(int value)
+{
+    if(value == 0)
+    {
+        recorder.rearm();
+    }
+    else if(value == 1)
+    {
+        recorder.freeze();
+    }
+    else if(value < 0)
+    {
+        replyInt(recorder.getState());
+        replyInt(recorder.count());
+        replyInt(recorder.triggerIndex());
+        replyInt(recorder.getDivider());
+        replyInt(recorder.getPost());
+    }
+    else
+    {
+        setError(ERR_RECORDER_CMD, value);
+    }
+}
+
+void setRecorderDivider(int value)
+{
+    if(value < 0)
+    {
+        replyInt(recorder.getDivider());
+    }
+    else if(!recorder.configure(value, recorder.getPost()))
+    {
+        setError(ERR_RECORDER_DIVIDER, value, REC_MAX_DIVIDER);
+    }
+}
+
+void setRecorderPost(int value)
+{
+    if(value < 0)
+    {
+        replyInt(recorder.getPost());
+    }
+    else if(!recorder.configure(recorder.getDivider(), value))
+    {
+        setError(ERR_RECORDER_POST, value, REC_MAX_POST);
+    }
+}
+
+// Replies with the entries held and the trigger index, then recorderCB() streams them (freezes the recorder first)
+void recorderDump()
+{
+    recorder.freeze();
+    dump_next = 0;
+    dump_active = true;
+
+    replyInt(recorder.count());
+    replyInt(recorder.triggerIndex());
+}
+
+void getLastError()
+{
+    ErrorEvent e;
+    char text[128];
+    events.latest(e);
+    EventLog::format(e, text, sizeof(text));
+
+    if(protocol_mode == PROTOCOL_ASCII) replyRaw("Last Error: ", 12);
+    replyText(text);
+}
+
+// Appends a segment to the profile of source : v,s,h - target [V], slew rate [V/s], hold [ms]
+void sequenceAdd(int source, const char* arg)
+{
+    SeqSegment segment;
+    unsigned long hold;
+
+    if(!arg || sscanf(arg, "%f,%f,%lu", &segment.target, &segment.slew, &hold) != 3 ||
+       !checkV(segment.target) || !checkSlew(segment.slew) || hold > SEQ_MAX_HOLD_MS)
+    {
+        setError(ERR_SEQ_SEGMENT, MaxSlewRate, SEQ_MAX_HOLD_MS);
+        return;
+    }
+    segment.hold_ms = hold;
+
+    dac_mutex.lock();
+    bool active = sequencer.isActive(source);
+    bool ok = sequencer.add(source, segment);
+    dac_mutex.unlock();
+
+    if(active)   setError(ERR_SEQ_BUSY, source);
+    else if(!ok) setError(ERR_SEQ_FULL, source, SEQ_MAX_SEGMENTS);
+}
+
+// ? - segment count, then v,s,h of each segment / 0 - clears the profile
+void sequenceList(int source, int value)
+{
+    dac_mutex.lock();
+    if(value == 0)
+    {
+        bool ok = sequencer.clear(source);
+        dac_mutex.unlock();
+        if(!ok) setError(ERR_SEQ_BUSY, source);
+        return;
+    }
+
+    if(value < 0)
+    {
+        int n = sequencer.count(source);
+        replyInt(n);
+        for(int i = 0; i < n; i++)
+        {
+            const SeqSegment& segment = sequencer.segment(source, i);
+            replyFloat(segment.target);
+            replyFloat(segment.slew);
+            replyInt(segment.hold_ms);
+        }
+    }
+    dac_mutex.unlock();
+}
+
+#define SEQ_CMD_ABORT  0
+#define SEQ_CMD_START  1
+#define SEQ_CMD_PAUSE  2
+#define SEQ_CMD_RESUME 3
+
+// Runs the profile of source. ? - state, segment, segments, phase (0 ramp, 1 hold), time left in the phase [ms]
+// Abort leaves the source at the level it reached, pause and resume do nothing unless running / paused
+void sequenceRun(int source, int value)
+{
+    if(value < 0)
+    {
+        dac_mutex.lock();
+        SeqProgress p = sequencer.progress(source, uptime_us());
+        dac_mutex.unlock();
+
+        replyInt(p.state);
+        replyInt(p.segment);
+        replyInt(p.count);
+        replyInt(p.phase);
+        replyInt(p.remaining_ms);
+        return;
+    }
+
+    dac_mutex.lock();
+    uint64_t now = uptime_us();
+    bool changed = false;
+    switch(value)
+    {
+        case SEQ_CMD_ABORT:
+            changed = sequencer.stop(source, ramp, SEQ_ABORTED);
+            if(changed) ramp.start(source, ramp.getLevel(source), now);
+            break;
+        case SEQ_CMD_START:
+            changed = hw.en->read(source) && sequencer.start(source, ramp, now);
+            if(!changed) setError(ERR_SEQ_START, source);
+            break;
+        case SEQ_CMD_PAUSE:
+            changed = sequencer.pause(source, ramp, now);
+            break;
+        case SEQ_CMD_RESUME:
+            changed = sequencer.resume(source, ramp, now);
+            break;
+        default:
+            setError(ERR_SEQ_CMD, value);
+            break;
+    }
+    rampPublish();
+    dac_mutex.unlock();
+
+    // The ramp thread picks up the new schedule (it may be waiting for the end of a hold)
+    if(changed) ramp_flags.set(RAMP_FLAG_START);
+}
+
+// Per profiled region : name, count, min, mean, max [us], since boot or the last reset
+void profileStats(int value)
+{
+#ifdef HV_PROFILE
+    if(value == 0)
+    {
+        profileReset();
+        return;
+    }
+    if(value > 0)
+    {
+        setError(ERR_PROFILE_CMD, value);
+        return;
+    }
+
+    float us_per_tick = 1e6f / profileTickRate();
+    for(int i = 0; i < PROF_NUM_SLOTS; i++)
+    {
+        ProfileStats s = profileGet((ProfileSlot)i);
+        replyText(profileName((ProfileSlot)i));
+        replyInt(s.count);
+        replyFloat(s.min * us_per_tick, 3);
+        replyFloat(s.count ? s.total * us_per_tick / s.count : 0.0f, 3);
+        replyFloat(s.max * us_per_tick, 3);
+    }
+#else
+    (void)value;
+    setError(ERR_PROFILE_DISABLED);
+#endif
+}
+
+#define EVENT_MAX_DRAIN 16
+
+// Event fields : time (us), code, source, then its text (text) or its two arguments (numeric)
+void replyEvent(const ErrorEvent& e, bool text)
+{
+    replyInt(e.t_us);
+    replyInt(e.code);
+    replyInt(e.source);
+    if(text)
+    {
+        char buffer[128];
+        EventLog::format(e, buffer, sizeof(buffer));
+        replyText(buffer);
+        return;
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        if(EventLog::isFloatArg(e.code, i)) replyFloat(e.arg[i].f, 3);
+        else                                replyInt(e.arg[i].i);
+    }
+}
+
+// ? pops the oldest event with its text, n pops up to n events as numbers (count first). Empty - code 0
+void drainEvents(int value)
+{
+    ErrorEvent e;
+    if(value < 0)
+    {
+        events.pop(e);
+        replyEvent(e, true);
+        return;
+    }
+    if(value < 1 || value > EVENT_MAX_DRAIN)
+    {
+        setError(ERR_EVENT_COUNT, value, EVENT_MAX_DRAIN);
+        return;
+    }
+
+    ErrorEvent drained[EVENT_MAX_DRAIN];
+    int n = 0;
+    while(n < value && events.pop(drained[n])) n++;
+
+    replyInt(n);
+    for(int i = 0; i < n; i++) replyEvent(drained[i], false);
+}
+
+// Oldest event with its text, left in the queue. Empty - code 0
+void peekEvent()
+{
+    ErrorEvent e;
+    events.peek(e);
+    replyEvent(e, true);
+}
+
+// ? - queued, total since the last clear, dropped, then code,count of every code that occurred / 0 - clears the queue and the counters
+void eventStats(int value)
+{
+    if(value == 0)
+    {
+        events.clear();
+        return;
+    }
+    if(value > 0)
+        return;
+
+    replyInt(events.queued());
+    replyInt(events.total());
+    replyInt(events.dropped());
+    for(int code = ERR_NONE + 1; code < ERR_NUM_CODES; code++)
+    {
+        uint32_t n = events.occurrences(code);
+        if(n == 0) continue;
+        replyInt(code);
+        replyInt(n);
+    }
+}
+
+// Adapters from the command table to the handlers above, which take the value (-1 for queries) and do both set and get
+template<void (*F)(int, int)> void sourceInt(const Command& c) { F(c.source, (int)c.value); }
+template<void (*F)(int, float)> void sourceFloat(const Command& c) { F(c.source, c.value); }
+template<void (*F)(int, const char*)> void sourceText(const Command& c) { F(c.source, c.arg); }
+template<void (*F)(int)> void globalInt(const Command& c) { F((int)c.value); }
+template<void (*F)(float)> void globalFloat(const Command& c) { F(c.value); }
+template<void (*F)()> void globalNone(const Command&) { F(); }
+
+#define HV_COMMAND(a, b, arg, flags, handler) { CMD_CODE(a, b), arg, flags, &handler, &handler }
+
+static constexpr CommandDesc HVCommandList[] = {
+    HV_COMMAND('P', 'O', CMD_ARG_INT,   0,               sourceInt<powerOnOff>),        // Set/Get Power On/Off
+    HV_COMMAND('S', 'V', CMD_ARG_INT,   0,               sourceInt<setVoltage>),        // Set/Get Voltage
+    HV_COMMAND('S', 'I', CMD_ARG_FLOAT, 0,               sourceFloat<setCurrent>),      // Set/Get Current
+    HV_COMMAND('S', 'R', CMD_ARG_FLOAT, 0,               sourceFloat<setSlewRate>),     // Set/Get Ramp Slew Rate
+    HV_COMMAND('F', 'T', CMD_ARG_INT,   0,               sourceInt<setFilterType>),     // Set/Get Monitor Filter Type
+    HV_COMMAND('F', 'P', CMD_ARG_FLOAT, 0,               sourceFloat<setFilterParam>),  // Set/Get Monitor Filter Parameter
+    HV_COMMAND('T', 'R', CMD_ARG_INT,   0,               sourceInt<tripState>),         // Get/Clear Over-current Trip State
+    HV_COMMAND('T', 'L', CMD_ARG_INT,   0,               sourceInt<tripLatency>),       // Get/Reset Trip Latency Statistics
+    HV_COMMAND('R', 'A', CMD_ARG_NONE,  CMD_FLAG_GLOBAL, globalNone<readAll>),          // Read All Monitors
+    HV_COMMAND('B', 'M', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<setProtocolMode>),   // Set/Get Protocol Mode (ASCII/Binary)
+    HV_COMMAND('T', 'S', CMD_ARG_FLOAT, CMD_FLAG_GLOBAL, globalFloat<setTelemetryRate>),// Set/Get Telemetry Stream Rate
+    HV_COMMAND('T', 'M', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<setTelemetryMask>),  // Set/Get Telemetry Channel Mask
+    HV_COMMAND('L', 'R', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<setLCDRate>),        // Set/Get LCD Refresh Rate
+    HV_COMMAND('C', 'P', CMD_ARG_TEXT,  0,               sourceText<calPoint>),         // Set Calibration Point (staged)
+    HV_COMMAND('C', 'A', CMD_ARG_TEXT,  0,               sourceText<calApply>),         // Apply Staged Calibration Table
+    HV_COMMAND('C', 'G', CMD_ARG_INT,   0,               sourceInt<calGet>),            // Get Calibration Table
+    HV_COMMAND('C', 'S', CMD_ARG_INT,   0,               sourceInt<calStore>),          // Store/Reset/Get Calibration State
+    HV_COMMAND('T', 'H', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<threadStats>),       // Get/Reset Thread Stats
+    HV_COMMAND('R', 'C', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<recorderControl>),   // Get Recorder State / Rearm / Freeze
+    HV_COMMAND('R', 'R', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<setRecorderDivider>),// Set/Get Recorder Sample Divider
+    HV_COMMAND('R', 'P', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<setRecorderPost>),   // Set/Get Recorder Post Trigger Share
+    HV_COMMAND('R', 'D', CMD_ARG_NONE,  CMD_FLAG_GLOBAL, globalNone<recorderDump>),     // Dump the Flight Recorder
+    HV_COMMAND('Q', 'A', CMD_ARG_TEXT,  0,               sourceText<sequenceAdd>),      // Append Voltage Profile Segment
+    HV_COMMAND('Q', 'L', CMD_ARG_INT,   0,               sourceInt<sequenceList>),      // Get/Clear Voltage Profile
+    HV_COMMAND('Q', 'R', CMD_ARG_INT,   0,               sourceInt<sequenceRun>),       // Start/Abort/Pause/Resume/Get Voltage Profile
+    HV_COMMAND('P', 'F', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<profileStats>),      // Get/Reset Hot Path Timings
+    HV_COMMAND('E', 'D', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<drainEvents>),       // Pop Queued Errors/Events
+    HV_COMMAND('E', 'P', CMD_ARG_NONE,  CMD_FLAG_GLOBAL, globalNone<peekEvent>),        // Peek the Oldest Queued Error/Event
+    HV_COMMAND('E', 'Q', CMD_ARG_INT,   CMD_FLAG_GLOBAL, globalInt<eventStats>),        // Get/Clear Error Queue Counters
+    HV_COMMAND('E', 'E', CMD_ARG_NONE,  CMD_FLAG_GLOBAL, globalNone<getLastError>)      // Get Last Error String
+};
+
+static constexpr CommandTable<CMD_COUNT(HVCommandList)> HVCommands = makeCommandTable(HVCommandList);
+static_assert(HVCommands.unique(), "Duplicated HV command code");
+
+void dispatch(const Command& c, bool batch)
+{
+    if(!batch)
+    {
+        char echo[64];
+        serialWrite(echo, sprintf(echo, "Got cmd (%d_%#04x_%f).\n\r", c.source, c.cmd, c.value));
+    }
+
+    command_source = c.source;
+    switch(dispatchCommand(HVCommands, c))
+    {
+        case DISPATCH_OK:
+            break;
+        case DISPATCH_NO_SOURCE:
+            setError(ERR_CMD_NO_SOURCE);
+            break;
+        case DISPATCH_BAD_ARG:
+            setError(ERR_CMD_NOT_NUMBER, c.cmd >> 8 & 0xFF, c.cmd & 0xFF);
+            break;
+        default:
+            setError(ERR_CMD_UNKNOWN, c.cmd >> 8 & 0xFF, c.cmd & 0xFF);
+            break;
+    }
+}
+
+void serialASCII(uint8_t byte)
+{
+    static CommandParser parser(SERIAL_STOP_BYTE);
+    Command c;
+
+    CommandStatus status = parser.feed(byte);
+
+    if(status == CMD_OVERFLOW)
+    {
+        setError(ERR_CMD_TOO_LONG, CMD_LINE_SIZE - 1);
+    }
+    else if(status == CMD_READY)
+    {
+        // Batch replies keep one field per command (empty for sets), separated like the commands
+        bool batch = parser.isBatch();
+        bool first = true;
+
+        while((status = parser.next(c)) != CMD_NONE)
+        {
+            if(batch && !first) replyRaw(";", 1);
+            first = false;
+            reply_fields = 0;
+
+            if(status == CMD_READY)
+            {
+                dispatch(c, batch);
+            }
+            else
+            {
+                setError(ERR_CMD_MALFORMED);
+            }
+        }
+        replySend();
+    }
+}
+
+void serialBinary(uint8_t byte)
+{
+    static BinaryProtocol protocol;
+    static BinaryFrame frame;
+
+    if(!protocol.feed(byte, frame))
+        return;
+
+    Command c;
+    c.source = (frame.source == 1 || frame.source == 2) ? frame.source : 0;
+    c.cmd = frame.cmd;
+    c.arg = nullptr;
+    c.value = -1.0f;
+    c.query = (frame.len == 0);
+
+    // [type] [value], the type tells a float from a 4 character text
+    char arg[BIN_MAX_PAYLOAD];
+    bool valid = true;
+    if(frame.len > 0)
+    {
+        if(frame.payload[0] == BIN_TYPE_FLOAT && frame.len == 1 + sizeof(float))
+        {
+            memcpy(&c.value, frame.payload + 1, sizeof(float));
+        }
+        else if(frame.payload[0] == BIN_TYPE_TEXT)
+        {
+            memcpy(arg, frame.payload + 1, frame.len - 1);
+            arg[frame.len - 1] = '\0';
+            c.arg = arg;
+            c.value = atof(arg);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    // Status byte first, the handler fills in the rest
+    uint32_t errors = error_count;
+    reply_len = 1;
+    reply_fields = 0;
+    reply_truncated = false;
+    if(valid)
+    {
+        dispatch(c, true);
+    }
+    else
+    {
+        command_source = c.source;
+        setError(ERR_CMD_MALFORMED);
+    }
+    reply[0] = (error_count == errors) ? BIN_STATUS_OK : BIN_STATUS_ERROR;
+    if(reply_truncated) reply[0] |= BIN_STATUS_TRUNCATED;
+
+    // Reuse the request frame for the reply, replyFits() keeps it within BIN_MAX_PAYLOAD
+    frame.len = reply_len;
+    memcpy(frame.payload, reply, reply_len);
+
+    uint8_t out[BIN_MAX_FRAME];
+    serialWrite(out, BinaryProtocol::encode(frame, out));
+    reply_len = 0;
+}
+
+void serialCB()
+{
+    PROFILE_SCOPE(PROF_SERIAL_CB);
+
+    // Only consume the bytes already received, never wait for the rest of a command
+    while(hw.serial->readable())
+    {
+        uint8_t byte = hw.serial->getc();
+
+        if(protocol_mode == PROTOCOL_ASCII) serialASCII(byte);
+        else                                serialBinary(byte);
+
+        protocol_mode = next_protocol_mode;
+    }
+}
+
+// Formats the pending telemetry samples and queues them, samples that don't fit are dropped
+void telemetryCB()
+{
+    static uint8_t seq = 0;
+    TelemetrySample s;
+
+    while(telemetry.pop(s))
+    {
+        uint8_t mask = telemetry.getMask();
+        float values[4] = {
+            monitorV(s.mon[ACQ_V1], 1) * 0.001f, monitorI(s.mon[ACQ_I1], 1) * 0.001f,
+            monitorV(s.mon[ACQ_V2], 2) * 0.001f, monitorI(s.mon[ACQ_I2], 2) * 0.001f
+        };
+
+        if(protocol_mode == PROTOCOL_ASCII)
+        {
+            // #T,<time us>[,V1][,I1][,V2][,I2][,flags]
+            char line[96];
+            int n = sprintf(line, "#T,%lu", (unsigned long)s.t_us);
+            for(int i = 0; i < 4; i++)
+            {
+                if(mask & (1 << i)) n += sprintf(line + n, ",%.2f", values[i]);
+            }
+            if(mask & TELEMETRY_STATE) n += sprintf(line + n, ",%d", s.flags);
+            n += sprintf(line + n, "\r\n");
+            tx.push(line, n);
+        }
+        else
+        {
+            // Unsolicited TS frame : [time us] [mask] [float fields...] [flags]
+            BinaryFrame frame;
+            frame.seq = seq++;
+            frame.source = 0;
+            frame.cmd = 0x5453;
+            frame.len = 0;
+
+            memcpy(frame.payload, &s.t_us, sizeof(s.t_us));
+            frame.len += sizeof(s.t_us);
+            frame.payload[frame.len++] = mask;
+            for(int i = 0; i < 4; i++)
+            {
+                if(!(mask & (1 << i))) continue;
+                memcpy(frame.payload + frame.len, &values[i], sizeof(float));
+                frame.len += sizeof(float);
+            }
+            if(mask & TELEMETRY_STATE) frame.payload[frame.len++] = s.flags;
+
+            uint8_t out[BIN_MAX_FRAME];
+            tx.push(out, BinaryProtocol::encode(frame, out));
+        }
+    }
+
+    serialDrain();
+}
+
+// Streams the frozen recorder after RD while there is room in the queue, a few frames per pass
+// RD frame : [first index (uint16)] [entries (16 bytes each, see RecordEntry)], an empty one ends the dump
+void recorderCB()
+{
+    static uint8_t seq = 0;
+
+    while(dump_active && tx.free() >= BIN_MAX_FRAME)
+    {
+        BinaryFrame frame;
+        frame.seq = seq++;
+        frame.source = 0;
+        frame.cmd = 0x5244;
+
+        RecordEntry entries[REC_DUMP_ENTRIES];
+        int n = recorder.read(dump_next, entries, REC_DUMP_ENTRIES);
+        uint16_t first = dump_next;
+        memcpy(frame.payload, &first, sizeof(first));
+        memcpy(frame.payload + sizeof(first), entries, n * sizeof(RecordEntry));
+        frame.len = sizeof(first) + n * sizeof(RecordEntry);
+
+        dump_next += n;
+        if(n == 0) dump_active = false;
+
+        uint8_t out[BIN_MAX_FRAME];
+        tx.push(out, BinaryProtocol::encode(frame, out));
+    }
+
+    serialDrain();
+}
+
+void updateLCD()
+{
+    PROFILE_SCOPE(PROF_UPDATE_LCD);
+
+    SourceState state;
+    source_state.read(state);
+
+    // The calibration may be changed by the comms thread meanwhile
+    dac_mutex.lock();
+    float ref_imon_value1 = averageI(state, 1);
+    float ref_vmon_value1 = averageV(state, 1);
+    float ref_imon_value2 = averageI(state, 2);
+    float ref_vmon_value2 = averageV(state, 2);
+    dac_mutex.unlock();
+    
+    updateLCDRealValues((int)ref_vmon_value1, (int)ref_vmon_value2, ref_imon_value1, ref_imon_value2);
+    updateLCDTargetValues((int)state.target_v[0], (int)state.target_v[1], state.limit_ua[0], state.limit_ua[1]);
+    display.update(uptime_us() / 1000);
+    lcdDrain();
+
+    // Over-current is checked by the protection on every sample, not here
+}
+
+// Feeds the flight recorder from the acquisition ISR : decimated monitors, and the changes since the previous sample
+void recordSample(const SourceState& state)
+{
+    static SourceState last = {};
+
+    if(recorder.sampleDue())
+    {
+        uint16_t flags = (state.en[0] ? TELEMETRY_EN1 : 0) | (state.en[1] ? TELEMETRY_EN2 : 0) |
+                         (state.tripped[0] ? TELEMETRY_TRIP1 : 0) | (state.tripped[1] ? TELEMETRY_TRIP2 : 0);
+        recorder.sample(state.t_us, state.mon, flags);
+    }
+
+    bool trip = false;
+    for(int i = 0; i < 2; i++)
+    {
+        if(state.en[i] != last.en[i])             recorder.event(state.t_us, REC_ENABLE, i + 1, state.en[i]);
+        if(state.target_v[i] != last.target_v[i]) recorder.event(state.t_us, REC_TARGET, i + 1, state.target_v[i]);
+        if(state.limit_ua[i] != last.limit_ua[i]) recorder.event(state.t_us, REC_LIMIT, i + 1, state.limit_ua[i]);
+        if(state.tripped[i] && !last.tripped[i])
+        {
+            recorder.event(state.t_us, REC_TRIP, i + 1, state.mon[SourceChannels[i][0]]);
+            trip = true;
+        }
+    }
+    if(trip) recorder.trigger();
+
+    last = state;
+}
+
+// Runs in the acquisition ISR after every sample
+void onSample()
+{
+    PROFILE_SCOPE(PROF_ON_SAMPLE);
+
+    protection.check();
+
+    SourceState state;
+    state.t_us = hw.adc->sampleTime();
+    for(int i = 0; i < ACQ_NUM_CHANNELS; i++)
+    {
+        state.mon[i] = hw.adc->filtered(i);
+    }
+
+    uint8_t ramping = setpoints.ramping.load(std::memory_order_relaxed);
+    for(int i = 0; i < 2; i++)
+    {
+        state.en[i] = hw.en->read(i + 1);
+        state.tripped[i] = protection.isTripped(i + 1);
+        state.ramping[i] = (ramping >> i) & 1;
+        state.target_v[i] = setpoints.target_v[i].load(std::memory_order_relaxed);
+        state.level_v[i] = setpoints.level_v[i].load(std::memory_order_relaxed);
+        state.limit_ua[i] = setpoints.limit_ua[i].load(std::memory_order_relaxed);
+    }
+    source_state.publish(state);
+
+    if(telemetry.due())
+    {
+        uint8_t flags = (state.en[0] ? TELEMETRY_EN1 : 0) | (state.en[1] ? TELEMETRY_EN2 : 0) |
+                        (state.tripped[0] ? TELEMETRY_TRIP1 : 0) | (state.tripped[1] ? TELEMETRY_TRIP2 : 0);
+
+        telemetry.record(state.t_us, state.mon, flags);
+    }
+
+    recordSample(state);
+}
+
+#define UI_PERIOD 10ms
+
+Thread comms_thread(osPriorityNormal, COMMS_STACK_SIZE, nullptr, "comms");
+Thread ui_thread(osPriorityBelowNormal, UI_STACK_SIZE, nullptr, "ui");
+
+Callback<void()> on_comms_pass;
+
+void onSerialRx()
+{
+    comms_flags.set(COMMS_FLAG_RX);
+}
+
+void commsThread()
+{
+    while(true)
+    {
+        comms_flags.wait_any_for(COMMS_FLAG_ALL, std::chrono::milliseconds(COMMS_POLL_MS));
+
+        comms_load.begin();
+
+        serialCB();
+        telemetryCB();
+        recorderCB();
+        comms_load.end();
+
+        if(on_comms_pass) on_comms_pass();
+    }
+}
+
+void uiThread()
+{
+    int shown_color = LED_NONE;
+
+    while(true)
+    {
+        ui_load.begin();
+        updateLCD();
+
+        int color = led_color;
+        if(color != shown_color)
+        {
+            if(color == LED_BLUE) hw.led->write(0.0, 0.0, 1.0);
+            else                  hw.led->write(1.0, 0.0, 0.0);
+            shown_color = color;
+        }
+        ui_load.end();
+
+        ThisThread::sleep_for(UI_PERIOD);
+    }
+}
+
+void controllerInit(const HVHardware& hardware)
+{
+    hw = hardware;
+
+    hw.en->write(1, 0);
+    hw.en->write(2, 0);
+    hw.dac->init();
+    profileInit();
+
+    calLoad(1);
+    calLoad(2);
+    updateTripLimit(1);
+    updateTripLimit(2);
+    protection.start(hw.adc, hw.en, callback(&onTrip), &events);
+    hw.adc->attach(callback(&onSample));
+    hw.adc->start();
+
+    uptime.start();
+    ramp_thread.start(rampThread);
+
+    hw.serial->attach(callback(&onSerialRx));
+    comms_thread.start(commsThread);
+    ui_thread.start(uiThread);
+}
+
+void controllerAttachCommsPass(Callback<void()> cb)
+{
+    on_comms_pass = cb;
+}
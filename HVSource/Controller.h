@@ -0,0 +1,13 @@
+#pragma once
+#include "HAL.h"
+
+// HV source controller : command handling, voltage ramps, over-current protection, telemetry and LCD.
+// All the hardware access goes through the HAL (see HAL.h), so the same code runs on the board and on the host simulator.
+
+// Starts the controller on the given hardware (sources disabled, DAC zeroed, acquisition running) and its threads
+// The caller's thread is not used afterwards
+void controllerInit(const HVHardware& hw);
+
+// cb is called by the comms thread after every pass over the received bytes, host tools use it to time the commands
+// Must be set before controllerInit()
+void controllerAttachCommsPass(Callback<void()> cb);
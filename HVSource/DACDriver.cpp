@@ -0,0 +1,75 @@
+#include "DACDriver.h"
+#include "../Common/ConstTable.h"
+
+// Upper byte control bits of each channel : address in bits 7-6, the same configuration (bits 5-4 set) for all
+constexpr uint8_t dacControl(int channel)
+{
+    return (channel << 6) | 0b00110000;
+}
+
+static constexpr ConstTable<uint8_t, DAC_NUM_CHANNELS> DacControl = makeTable<uint8_t, DAC_NUM_CHANNELS>(dacControl);
+
+DACDriver::DACDriver(PinName mosi, PinName miso, PinName sclk, PinName cs)
+    : spi(mosi, miso, sclk), cs(cs, 1)
+{
+    for(int i = 0; i < DAC_NUM_CHANNELS; i++)
+    {
+        last_write_us[i] = 0;
+    }
+}
+
+void DACDriver::init()
+{
+    cs = 1;
+    spi.format(8, 0);
+    spi.frequency(DAC_SPI_FREQ);
+    timer.start();
+}
+
+void DACDriver::frame(int channel, uint16_t code)
+{
+    // Only wait if this channel output is still settling from the previous write
+    uint32_t dt = (uint32_t)timer.elapsed_time().count() - last_write_us[channel];
+    if(dt < DAC_SETTLE_US)
+    {
+        wait_us(DAC_SETTLE_US - dt);
+    }
+
+    char data[2];
+    data[0] = ((code >> 8) & 0x0F) | DacControl[channel]; // Upper 4 bits and channel address
+    data[1] = code & 0xFF;                                // Lower 8 bits
+
+    cs = 0;
+    spi.write(data, 2, nullptr, 0);
+    cs = 1;
+
+    last_write_us[channel] = timer.elapsed_time().count();
+}
+
+void DACDriver::write(int channel, float ref)
+{
+    spi.lock();
+    frame(channel, toCode(ref));
+    spi.unlock();
+}
+
+void DACDriver::writeBatch(const float* ref, uint8_t mask)
+{
+    uint16_t code[DAC_NUM_CHANNELS];
+    for(int i = 0; i < DAC_NUM_CHANNELS; i++)
+    {
+        code[i] = (mask & (1 << i)) ? toCode(ref[i]) : 0;
+    }
+    writeCodes(code, mask);
+}
+
+void DACDriver::writeCodes(const uint16_t* code, uint8_t mask)
+{
+    // Hold the bus for all the channels, each word still needs its own chip select pulse to latch
+    spi.lock();
+    for(int i = 0; i < DAC_NUM_CHANNELS; i++)
+    {
+        if(mask & (1 << i)) frame(i, code[i]);
+    }
+    spi.unlock();
+}
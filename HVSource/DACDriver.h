@@ -0,0 +1,38 @@
+#pragma once
+#include "mbed.h"
+#include "HAL.h"
+
+// Driver for the quad 12 bit SPI DAC that sets the HV sources references.
+// Channels : A - Source 1 current limit, B - Source 1 voltage, C - Source 2 current limit, D - Source 2 voltage
+// Every 16 bit word is latched on the chip select rising edge, so no blanket delay is required after a write.
+// The only timing requirement enforced is the output settling time when the same channel is rewritten too fast.
+
+#define DAC_SETTLE_US 10   // Output settling time (full scale step, worst case)
+#define DAC_SPI_FREQ 1000000
+
+class DACDriver : public DacHal
+{
+public:
+    DACDriver(PinName mosi, PinName miso, PinName sclk, PinName cs);
+
+    void init() override;
+
+    // Writes a single channel [0 - A, 3 - D], ref in mV
+    void write(int channel, float ref) override;
+
+    // Writes all the channels set in mask (bit 0 -> A) in a single bus transaction
+    // ref must hold DAC_NUM_CHANNELS values in mV, unmasked entries are ignored
+    void writeBatch(const float* ref, uint8_t mask) override;
+    void writeCodes(const uint16_t* code, uint8_t mask) override;
+
+private:
+    void frame(int channel, uint16_t code);
+
+private:
+    SPI spi;
+    DigitalOut cs;
+
+    // Time of the last write of each channel, used to respect the settling time
+    Timer timer;
+    uint32_t last_write_us[DAC_NUM_CHANNELS];
+};
@@ -0,0 +1,188 @@
+#include "EventLog.h"
+#include "Platform.h"
+#include <cstdio>
+
+#define ARG0_FLOAT 0x01
+#define ARG1_FLOAT 0x02
+
+struct EventText
+{
+    const char* fmt;
+    uint8_t types;  // ARG0_FLOAT / ARG1_FLOAT, the others are int
+};
+
+// Indexed by ErrorCode
+static const EventText EventTexts[ERR_NUM_CODES] = {
+    { "No error.", 0 },
+    { "Command error. Specified source not available. Possible values [1, 2].", 0 },
+    { "Command error. Value of [%c%c] is not a number.", 0 },
+    { "Command [%c%c] not recognized.", 0 },
+    { "Command error. Command too long (max %d bytes).", 0 },
+    { "Command error. Malformed command, expected format nCCv.", 0 },
+    { "Desired voltage (%d V) too high (max 2400 V).", 0 },
+    { "Desired current (%.2f uA) too high (max 500 uA).", ARG0_FLOAT },
+    { "Desired slew rate (%.2f V/s) out of range (max %.0f V/s).", ARG0_FLOAT | ARG1_FLOAT },
+    { "Filter type (%d) not available. Possible values [0, 3].", 0 },
+    { "Filter parameter (%.2f) out of range for filter type %d.", ARG0_FLOAT },
+    { "Protocol mode (%d) not available. Possible values [0, 1].", 0 },
+    { "Telemetry rate (%.2f Hz) out of range (max %d Hz).", ARG0_FLOAT },
+    { "Telemetry mask (%d) not valid. Possible values [0, %d].", 0 },
+    { "LCD refresh rate (%d Hz) out of range. Possible values [1, %d].", 0 },
+    { "Thread stats (%d) not valid. Possible values ? or 0 (reset the CPU use).", 0 },
+    { "Recorder command (%d) not valid. Possible values ?, 0 (rearm) or 1 (freeze).", 0 },
+    { "Recorder divider (%d) out of range. Possible values [1, %d].", 0 },
+    { "Recorder post trigger share (%d) out of range. Possible values [0, %d] %%.", 0 },
+    { "Event count (%d) out of range. Possible values ? or [1, %d].", 0 },
+    { "Stored calibration of source %d is corrupted. Using the factory calibration.", 0 },
+    { "Calibration point not valid. Expected t,i,x,y with t [0, %d] and i [0, %d].", 0 },
+    { "Calibration apply not valid. Expected t,n.", 0 },
+    { "Calibration table %d rejected. Needs [2, %d] points strictly increasing in x and y.", 0 },
+    { "Calibration table (%d) not available. Possible values [0, %d].", 0 },
+    { "Failed to store the calibration of source %d.", 0 },
+    { "Max current exceded. Disabling HV source %d...", 0 },
+    { "Profiling not built in. Build with HV_PROFILE.", 0 },
+    { "Profile command (%d) not valid. Possible values ? or 0 (reset).", 0 },
+    { "Sequence segment not valid. Expected v,s,h with v [0, 2400) V, s (0, %.0f] V/s and h [0, %d] ms.", ARG0_FLOAT },
+    { "Sequence of source %d full (max %d segments).", 0 },
+    { "Sequence of source %d is running. Abort it first.", 0 },
+    { "Sequence of source %d can't start. Needs segments and the source on.", 0 },
+    { "Sequence command (%d) not valid. Possible values ?, 0 (abort), 1 (start), 2 (pause) or 3 (resume).", 0 },
+    { "Sequence of source %d stopped at segment %d.", 0 }
+};
+
+EventLog::EventLog()
+    : head(0), tail(0), cleared_at(0), drops(0)
+{
+    for(uint32_t i = 0; i < EVENT_QUEUE_SIZE; i++)
+    {
+        slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    for(int i = 0; i < ERR_NUM_CODES; i++)
+    {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool EventLog::post(ErrorCode code, uint8_t source, EventArg a0, EventArg a1)
+{
+    counts[code < ERR_NUM_CODES ? code : ERR_NONE].fetch_add(1, std::memory_order_relaxed);
+
+    // Reserve a position, retried only if another producer (a preempting ISR) took it first
+    uint32_t pos = head.load(std::memory_order_relaxed);
+    Slot* slot;
+    while(true)
+    {
+        slot = &slots[pos & (EVENT_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t)(slot->seq.load(std::memory_order_acquire) - pos);
+
+        if(diff == 0)
+        {
+            if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(diff < 0)
+        {
+            // Not read yet, full
+            drops.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->event.t_us = us_ticker_read();
+    slot->event.code = code;
+    slot->event.source = source;
+    slot->event.arg[0] = a0;
+    slot->event.arg[1] = a1;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool EventLog::peek(ErrorEvent& e) const
+{
+    const Slot& slot = slots[tail & (EVENT_QUEUE_SIZE - 1)];
+
+    // Empty, or the producer that reserved it is still writing
+    if(slot.seq.load(std::memory_order_acquire) != tail + 1)
+        return false;
+
+    e = slot.event;
+    return true;
+}
+
+bool EventLog::pop(ErrorEvent& e)
+{
+    if(!peek(e))
+        return false;
+
+    // Hand the slot back for position tail + EVENT_QUEUE_SIZE
+    slots[tail & (EVENT_QUEUE_SIZE - 1)].seq.store(tail + EVENT_QUEUE_SIZE, std::memory_order_release);
+    tail++;
+    return true;
+}
+
+bool EventLog::latest(ErrorEvent& e) const
+{
+    uint32_t h = head.load(std::memory_order_acquire);
+    if(h == cleared_at)
+        return false;
+
+    // Written (popped or not), and not reserved again by a later position
+    const Slot& slot = slots[(h - 1) & (EVENT_QUEUE_SIZE - 1)];
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if(seq != h && seq != h - 1 + EVENT_QUEUE_SIZE)
+        return false;
+
+    e = slot.event;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return head.load(std::memory_order_relaxed) - h < EVENT_QUEUE_SIZE;
+}
+
+void EventLog::clear()
+{
+    ErrorEvent e;
+    while(pop(e)) {  }
+
+    cleared_at = head.load(std::memory_order_acquire);
+    drops.store(0, std::memory_order_relaxed);
+    for(int i = 0; i < ERR_NUM_CODES; i++)
+    {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+uint32_t EventLog::queued() const
+{
+    return head.load(std::memory_order_acquire) - tail;
+}
+
+uint32_t EventLog::total() const
+{
+    return head.load(std::memory_order_acquire) - cleared_at + drops.load(std::memory_order_relaxed);
+}
+
+bool EventLog::isFloatArg(uint16_t code, int n)
+{
+    return code < ERR_NUM_CODES && (EventTexts[code].types & (1 << n));
+}
+
+int EventLog::format(const ErrorEvent& e, char* buffer, int size)
+{
+    if(e.code >= ERR_NUM_CODES)
+        return snprintf(buffer, size, "Unknown error (%d).", e.code);
+
+    // The arguments are passed with the types the text expects
+    const EventText& text = EventTexts[e.code];
+    int n;
+    switch(text.types)
+    {
+        case ARG0_FLOAT:              n = snprintf(buffer, size, text.fmt, (double)e.arg[0].f, (int)e.arg[1].i); break;
+        case ARG1_FLOAT:              n = snprintf(buffer, size, text.fmt, (int)e.arg[0].i, (double)e.arg[1].f); break;
+        case ARG0_FLOAT | ARG1_FLOAT: n = snprintf(buffer, size, text.fmt, (double)e.arg[0].f, (double)e.arg[1].f); break;
+        default:                      n = snprintf(buffer, size, text.fmt, (int)e.arg[0].i, (int)e.arg[1].i); break;
+    }
+    return n < size ? n : size - 1;
+}
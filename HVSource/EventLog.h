@@ -0,0 +1,137 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+// Errors and events of the controller, kept as numeric records until the host asks for them (EE, ED, EP, EQ).
+// post() only stores a code, the source, two numeric arguments and the time : no formatting, no locks.
+// It can be called from any thread or ISR (the over-current trip posts from the acquisition ISR).
+// The queue is a bounded multi producer / single consumer queue (per slot sequence numbers, compare and swap on the head),
+// the consumer is the comms thread. When it is full new events are dropped and counted, the per code counters still count them.
+// The text of each code lives in a table (EventLog.cpp), format() builds the message on request.
+
+#define EVENT_QUEUE_SIZE 32 // Power of 2
+
+static_assert((EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)) == 0, "EVENT_QUEUE_SIZE must be a power of 2.");
+
+// Numeric codes reported to the host, never renumber them
+enum ErrorCode : uint16_t
+{
+    ERR_NONE = 0,
+
+    // Commands
+    ERR_CMD_NO_SOURCE       = 1,
+    ERR_CMD_NOT_NUMBER      = 2,    // Command code (2 chars)
+    ERR_CMD_UNKNOWN         = 3,    // Command code (2 chars)
+    ERR_CMD_TOO_LONG        = 4,    // Max length
+    ERR_CMD_MALFORMED       = 5,
+
+    // Setpoints and monitors
+    ERR_VOLTAGE_RANGE       = 6,    // Value
+    ERR_CURRENT_RANGE       = 7,    // Value
+    ERR_SLEW_RANGE          = 8,    // Value, max
+    ERR_FILTER_TYPE         = 9,    // Value
+    ERR_FILTER_PARAM        = 10,   // Value, filter type
+
+    // Communication and settings
+    ERR_PROTOCOL_MODE       = 11,   // Value
+    ERR_TELEMETRY_RATE      = 12,   // Value, max
+    ERR_TELEMETRY_MASK      = 13,   // Value, max
+    ERR_LCD_RATE            = 14,   // Value, max
+    ERR_THREAD_STATS        = 15,   // Value
+    ERR_RECORDER_CMD        = 16,   // Value
+    ERR_RECORDER_DIVIDER    = 17,   // Value, max
+    ERR_RECORDER_POST       = 18,   // Value, max
+    ERR_EVENT_COUNT         = 19,   // Value, max
+
+    // Calibration
+    ERR_CAL_CORRUPTED       = 20,   // Source
+    ERR_CAL_POINT           = 21,   // Max table, max point
+    ERR_CAL_APPLY           = 22,
+    ERR_CAL_REJECTED        = 23,   // Table, max points
+    ERR_CAL_TABLE           = 24,   // Value, max
+    ERR_CAL_STORE           = 25,   // Source
+
+    // Protection
+    ERR_TRIP                = 26,   // Source, current monitor [ADC counts]
+
+    // Profiling
+    ERR_PROFILE_DISABLED    = 27,
+    ERR_PROFILE_CMD         = 28,   // Value
+
+    // Voltage profiles
+    ERR_SEQ_SEGMENT         = 29,   // Max slew, max hold
+    ERR_SEQ_FULL            = 30,   // Source, max segments
+    ERR_SEQ_BUSY            = 31,   // Source
+    ERR_SEQ_START           = 32,   // Source
+    ERR_SEQ_CMD             = 33,   // Value
+    ERR_SEQ_STOPPED         = 34,   // Source, segment
+
+    ERR_NUM_CODES
+};
+
+// Argument of an event, its type (int or float) is given by the format of the code
+union EventArg
+{
+    int32_t i;
+    float f;
+
+    EventArg(int v) : i(v) {  }
+    EventArg(float v) : f(v) {  }
+};
+
+struct ErrorEvent
+{
+    uint32_t t_us;      // us ticker time
+    uint16_t code;      // ErrorCode
+    uint8_t source;     // 1 or 2, 0 if not tied to a source
+    uint8_t reserved;
+    EventArg arg[2];
+
+    ErrorEvent() : t_us(0), code(ERR_NONE), source(0), reserved(0), arg{ 0, 0 } {  }
+};
+
+class EventLog
+{
+public:
+    EventLog();
+
+    // Producer side (any thread or ISR). Returns false if the queue was full (the event is only counted)
+    bool post(ErrorCode code, uint8_t source, EventArg a0 = 0, EventArg a1 = 0);
+
+    // Consumer side (one thread)
+    bool pop(ErrorEvent& e);
+    bool peek(ErrorEvent& e) const;
+
+    // Newest event posted since the last clear(), even if already popped. False if none
+    bool latest(ErrorEvent& e) const;
+
+    // Drops the queued events and resets the counters
+    void clear();
+
+    uint32_t queued() const;
+    // Events posted since the last clear(), dropped ones included
+    uint32_t total() const;
+    uint32_t dropped() const { return drops.load(std::memory_order_relaxed); }
+    uint32_t occurrences(uint16_t code) const { return code < ERR_NUM_CODES ? counts[code].load(std::memory_order_relaxed) : 0; }
+
+    // True if argument n of code is a float
+    static bool isFloatArg(uint16_t code, int n);
+
+    // Message of e (as EE always reported them), returns the length
+    static int format(const ErrorEvent& e, char* buffer, int size);
+
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> seq;  // Position it can be written at, position + 1 once written
+        ErrorEvent event;
+    };
+
+    Slot slots[EVENT_QUEUE_SIZE];
+    std::atomic<uint32_t> head;     // Next position to reserve (producers)
+    uint32_t tail;                  // Next position to read (consumer)
+    uint32_t cleared_at;            // head at the last clear() (consumer)
+
+    std::atomic<uint32_t> drops;
+    std::atomic<uint32_t> counts[ERR_NUM_CODES];
+};
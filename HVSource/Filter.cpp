@@ -0,0 +1,128 @@
+#include "Filter.h"
+#include <cmath>
+#include <cstring>
+
+Filter::Filter() : type(FILTER_NONE), param(0.0f), length(1), alpha_q16(0)
+{
+    reset();
+}
+
+float Filter::defaultParam(FilterType type)
+{
+    switch(type)
+    {
+        case FILTER_AVERAGE: return FILTER_DEFAULT_AVERAGE;
+        case FILTER_IIR:     return FILTER_DEFAULT_IIR;
+        case FILTER_MEDIAN:  return FILTER_DEFAULT_MEDIAN;
+        default:             return 0.0f;
+    }
+}
+
+bool Filter::configure(FilterType type, float param, float sample_rate)
+{
+    switch(type)
+    {
+        case FILTER_NONE:
+            length = 1;
+            break;
+        case FILTER_AVERAGE:
+            if(param < 1 || param > FILTER_MAX_WINDOW) return false;
+            length = (uint16_t)param;
+            break;
+        case FILTER_MEDIAN:
+            if(param < 1 || param > FILTER_MAX_MEDIAN || ((int)param % 2) == 0) return false;
+            length = (uint16_t)param;
+            break;
+        case FILTER_IIR:
+        {
+            if(param <= 0.0f || param > FILTER_MAX_IIR) return false;
+            // Exact discretization of the RC low pass, computed once here
+            float alpha = 1.0f - expf(-1000.0f / (param * sample_rate));
+            alpha_q16 = (int32_t)(alpha * 65536.0f);
+            if(alpha_q16 < 1) alpha_q16 = 1;
+            length = 1;
+        }
+        break;
+        default:
+            return false;
+    }
+
+    this->type = type;
+    this->param = param;
+    reset();
+    return true;
+}
+
+void Filter::reset()
+{
+    memset(window, 0, sizeof(window));
+    index = 0;
+    sum = 0;
+    y_q15 = 0;
+    out = 0;
+    seeded = false;
+}
+
+void Filter::seed(uint16_t x)
+{
+    for(uint16_t i = 0; i < length; i++)
+    {
+        window[i] = x;
+    }
+    index = 0;
+    sum = (uint32_t)x * length;
+    y_q15 = (int32_t)x << 15;
+    out = x;
+    seeded = true;
+}
+
+uint16_t Filter::process(uint16_t x)
+{
+    if(!seeded) seed(x);
+
+    switch(type)
+    {
+        case FILTER_AVERAGE:
+        {
+            // O(1) moving sum, swap the oldest sample for the new one
+            sum += x - window[index];
+            window[index] = x;
+            index = (index + 1) % length;
+            out = sum / length;
+        }
+        break;
+        case FILTER_IIR:
+        {
+            int32_t diff = ((int32_t)x << 15) - y_q15;
+            y_q15 += (int32_t)(((int64_t)alpha_q16 * diff) >> 16);
+            out = y_q15 >> 15;
+        }
+        break;
+        case FILTER_MEDIAN:
+        {
+            window[index] = x;
+            index = (index + 1) % length;
+
+            // Insertion sort on a copy, the window is tiny
+            uint16_t s[FILTER_MAX_MEDIAN];
+            for(uint16_t i = 0; i < length; i++)
+            {
+                uint16_t v = window[i];
+                int j = i - 1;
+                while(j >= 0 && s[j] > v)
+                {
+                    s[j + 1] = s[j];
+                    j--;
+                }
+                s[j + 1] = v;
+            }
+            out = s[length / 2];
+        }
+        break;
+        default:
+            out = x;
+            break;
+    }
+
+    return out;
+}
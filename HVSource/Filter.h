@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+
+// Streaming filters for the monitor samples, cheap enough to run per sample inside the acquisition ISR.
+// All the coefficients are precomputed in configure(), process() only uses integer math.
+// The history starts from the first sample (or a seed), never from 0, so a new filter does not read low while it fills.
+
+enum FilterType : uint8_t
+{
+    FILTER_NONE    = 0, // Pass through
+    FILTER_AVERAGE = 1, // Moving average (param : window length [samples])
+    FILTER_IIR     = 2, // Single pole low pass (param : time constant [ms])
+    FILTER_MEDIAN  = 3  // Moving median, spike rejection (param : window length [samples], odd)
+};
+
+#define FILTER_MAX_WINDOW 128
+#define FILTER_MAX_MEDIAN 9
+#define FILTER_MAX_IIR 1000.0f  // [ms], the Q16 coefficient is down to 13 counts there at 5 kHz
+
+#define FILTER_DEFAULT_AVERAGE 100
+#define FILTER_DEFAULT_IIR 5.0f
+#define FILTER_DEFAULT_MEDIAN 5
+
+class Filter
+{
+public:
+    Filter();
+
+    // Returns false if the parameter is out of range for the type (the filter is left untouched)
+    bool configure(FilterType type, float param, float sample_rate);
+
+    uint16_t process(uint16_t x);
+
+    // Fills the history with x as if it had been steady, e.g. the output of the filter this one replaces
+    void seed(uint16_t x);
+    bool isSeeded() const { return seeded; }
+
+    uint16_t output() const { return out; }
+    FilterType getType() const { return type; }
+    float getParam() const { return param; }
+
+    static float defaultParam(FilterType type);
+
+private:
+    void reset();
+
+private:
+    FilterType type;
+    float param;
+
+    // Moving average and median history
+    uint16_t window[FILTER_MAX_WINDOW];
+    uint16_t length;
+    uint16_t index;
+    uint32_t sum;
+
+    // IIR state, y[n] = y[n-1] + alpha * (x[n] - y[n-1])
+    int32_t alpha_q16; // Q16
+    int32_t y_q15;     // Q15
+
+    volatile uint16_t out;
+    bool seeded;    // False until the first sample or seed()
+};
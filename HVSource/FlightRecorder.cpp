@@ -0,0 +1,122 @@
+#include "FlightRecorder.h"
+#include "Platform.h"
+#include <cstring>
+
+FlightRecorder::FlightRecorder()
+    : head(0), trigger_at(0), post_left(0), state(REC_ARMED), triggered(false),
+      divider(REC_DEFAULT_DIVIDER), counter(0), post(REC_DEFAULT_POST)
+{
+
+}
+
+bool FlightRecorder::sampleDue()
+{
+    if(state == REC_FROZEN || ++counter < divider)
+        return false;
+
+    counter = 0;
+    return true;
+}
+
+void FlightRecorder::push(const RecordEntry& e)
+{
+    if(state == REC_FROZEN)
+        return;
+
+    entries[head & (REC_SIZE - 1)] = e;
+    head = head + 1;
+
+    if(state == REC_TRIGGERED && --post_left == 0)
+        state = REC_FROZEN;
+}
+
+void FlightRecorder::sample(uint32_t t_us, const uint16_t* mon, uint16_t flags)
+{
+    RecordEntry e;
+    e.t_us = t_us;
+    e.type = REC_SAMPLE;
+    e.source = 0;
+    e.flags = flags;
+    memcpy(e.mon, mon, sizeof(e.mon));
+    push(e);
+}
+
+void FlightRecorder::event(uint32_t t_us, RecordType type, uint8_t source, float value)
+{
+    RecordEntry e;
+    memset(&e, 0, sizeof(e));
+    e.t_us = t_us;
+    e.type = type;
+    e.source = source;
+    e.value = value;
+    push(e);
+}
+
+void FlightRecorder::trigger()
+{
+    if(state != REC_ARMED)
+        return;
+
+    // The trigger entry itself is already in, keep the post window after it
+    trigger_at = head - 1;
+    triggered = true;
+    post_left = (uint32_t)REC_SIZE * post / 100;
+    state = post_left ? REC_TRIGGERED : REC_FROZEN;
+}
+
+bool FlightRecorder::configure(int divider, int post)
+{
+    if(divider < 1 || divider > REC_MAX_DIVIDER || post < 0 || post > REC_MAX_POST)
+        return false;
+
+    CriticalSectionLock lock;
+    this->divider = divider;
+    this->post = post;
+    counter = 0;
+    return true;
+}
+
+void FlightRecorder::rearm()
+{
+    CriticalSectionLock lock;
+    head = 0;
+    counter = 0;
+    triggered = false;
+    state = REC_ARMED;
+}
+
+void FlightRecorder::freeze()
+{
+    CriticalSectionLock lock;
+    state = REC_FROZEN;
+}
+
+uint32_t FlightRecorder::count() const
+{
+    uint32_t h = head;
+    return h < REC_SIZE ? h : REC_SIZE;
+}
+
+int32_t FlightRecorder::triggerIndex() const
+{
+    if(state != REC_FROZEN || !triggered)
+        return -1;
+
+    uint32_t first = head - count();
+    return (int32_t)(trigger_at - first);
+}
+
+int FlightRecorder::read(uint32_t index, RecordEntry* out, int n) const
+{
+    if(state != REC_FROZEN)
+        return 0;
+
+    uint32_t held = count();
+    uint32_t first = head - held;
+    int copied = 0;
+    while(copied < n && index < held)
+    {
+        out[copied++] = entries[(first + index++) & (REC_SIZE - 1)];
+    }
+    return copied;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <cstdint>
+#include "HAL.h"
+
+// Flight recorder : the recent history of both sources, kept in RAM to see what led to a trip.
+// All the entries are written by the acquisition ISR (single producer, no locks on that side) :
+//   REC_SAMPLE - filtered monitors, one every divider acquisition samples
+//   REC_ENABLE / REC_TARGET / REC_LIMIT - a source was switched on/off, or its voltage target / current limit changed
+//   REC_TRIP   - over-current trip, also the trigger
+// The buffer is circular while armed. A trigger keeps recording for the post trigger share of the buffer,
+// then freezes it : the rest of the buffer is the pre trigger history. Only rearm() starts recording again,
+// so the first trip is the one kept. The entries are only read while frozen.
+
+#define REC_SIZE 2048               // Entries (16 bytes each), power of 2
+#define REC_DEFAULT_DIVIDER 5       // 1 kHz at ACQ_RATE_HZ, ~1.6 s before a trip with the default post trigger share
+#define REC_MAX_DIVIDER 5000
+#define REC_DEFAULT_POST 20         // [%] of the buffer recorded after the trigger
+#define REC_MAX_POST 90
+
+enum RecordType : uint8_t
+{
+    REC_SAMPLE = 0,
+    REC_ENABLE = 1,
+    REC_TARGET = 2,     // [V]
+    REC_LIMIT  = 3,     // [uA]
+    REC_TRIP   = 4
+};
+
+enum RecorderState : uint8_t
+{
+    REC_ARMED     = 0,
+    REC_TRIGGERED = 1,  // Recording the post trigger window
+    REC_FROZEN    = 2
+};
+
+// Dumped as is (little-endian, 16 bytes)
+struct RecordEntry
+{
+    uint32_t t_us;              // us ticker time
+    uint8_t type;               // RecordType
+    uint8_t source;             // 1 or 2, 0 for samples
+    uint16_t flags;             // Samples : enable and trip flags (TELEMETRY_EN1 ... TELEMETRY_TRIP2)
+    union
+    {
+        uint16_t mon[ACQ_NUM_CHANNELS]; // Samples : filtered monitors [ADC counts], acquisition channel order
+        float value;                    // Events : new enable state (0 / 1), target, limit, current monitor at the trip [ADC counts]
+    };
+};
+
+static_assert(sizeof(RecordEntry) == 16, "RecordEntry is dumped as 16 bytes");
+
+class FlightRecorder
+{
+public:
+    FlightRecorder();
+
+    // Producer side (acquisition ISR)
+    bool sampleDue();
+    void sample(uint32_t t_us, const uint16_t* mon, uint16_t flags);
+    void event(uint32_t t_us, RecordType type, uint8_t source, float value);
+    void trigger();
+
+    // Control side (any thread)
+    // divider : 1 to REC_MAX_DIVIDER, post : 0 to REC_MAX_POST [%]. Returns false if out of range
+    bool configure(int divider, int post);
+    uint32_t getDivider() const { return divider; }
+    uint8_t getPost() const { return post; }
+
+    // Clears the buffer and starts recording again
+    void rearm();
+
+    // Freezes right away (manual trigger, no post trigger window)
+    void freeze();
+
+    RecorderState getState() const { return state; }
+
+    // Entries held (up to REC_SIZE)
+    uint32_t count() const;
+
+    // Position of the trigger among the held entries (0 - oldest), -1 if frozen without a trigger
+    int32_t triggerIndex() const;
+
+    // Copies up to n entries starting at index (0 - oldest), only while frozen. Returns the number copied
+    int read(uint32_t index, RecordEntry* out, int n) const;
+
+private:
+    void push(const RecordEntry& e);
+
+private:
+    RecordEntry entries[REC_SIZE];
+    volatile uint32_t head;         // Entries written since the last rearm
+    volatile uint32_t trigger_at;   // head at the trigger
+    volatile uint32_t post_left;
+    volatile RecorderState state;
+    volatile bool triggered;
+
+    volatile uint32_t divider;
+    uint32_t counter;
+    volatile uint8_t post;
+};
@@ -0,0 +1,153 @@
+#pragma once
+#include "Platform.h"
+#include "Filter.h"
+
+// Thin hardware abstraction used by the controller logic (Controller.cpp).
+// The target implements it on top of the board drivers (main.cpp), the host build with simulated drivers (sim/).
+// Sources are numbered [1, 2] like everywhere else in the firmware.
+
+// DAC channels : A - Source 1 current limit, B - Source 1 voltage, C - Source 2 current limit, D - Source 2 voltage
+#define DAC_NUM_CHANNELS 4
+
+#define DAC_MASK_A 0x01
+#define DAC_MASK_B 0x02
+#define DAC_MASK_C 0x04
+#define DAC_MASK_D 0x08
+#define DAC_MASK_ALL 0x0F
+
+// 12 bit DAC, 3.3 V reference
+#define DAC_RESOLUTION 4096
+#define DAC_VREF_MV 3300
+
+// Monitor channels
+#define ACQ_NUM_CHANNELS 4
+#define ACQ_RATE_HZ 5000
+
+// read_u16() counts, 3.3 V reference
+#define ADC_FULL_SCALE 65535
+#define ADC_VREF 3.3f
+
+#define ACQ_I1 0 // PA_0 - Source 1 current monitor
+#define ACQ_V1 1 // PA_1 - Source 1 voltage monitor
+#define ACQ_I2 2 // PC_1 - Source 2 current monitor
+#define ACQ_V2 3 // PC_0 - Source 2 voltage monitor
+
+class DacHal
+{
+public:
+    virtual ~DacHal() {  }
+
+    virtual void init() = 0;
+
+    // Writes a single channel [0 - A, 3 - D], ref in mV
+    virtual void write(int channel, float ref) = 0;
+
+    // Writes all the channels set in mask (bit 0 -> A) in a single bus transaction, ref in mV
+    virtual void writeBatch(const float* ref, uint8_t mask) = 0;
+
+    // Same as writeBatch() with the DAC codes already computed
+    virtual void writeCodes(const uint16_t* code, uint8_t mask) = 0;
+
+    // Reference [mV] -> DAC code, saturated
+    static uint16_t toCode(float ref)
+    {
+        return clampCode((int32_t)(ref * ((float)DAC_RESOLUTION / DAC_VREF_MV)));
+    }
+
+    static uint16_t clampCode(int32_t value)
+    {
+        if(value < 0) return 0;
+        if(value > DAC_RESOLUTION - 1) return DAC_RESOLUTION - 1;
+        return value;
+    }
+};
+
+class AdcHal
+{
+public:
+    virtual ~AdcHal() {  }
+
+    // Starts sampling all the channels at ACQ_RATE_HZ
+    virtual void start() = 0;
+
+    // Latest filtered value of channel ch [V at the ADC pin]
+    virtual float read(int ch) const = 0;
+
+    // Latest filtered sample of channel ch [0 - 65535]
+    virtual uint16_t filtered(int ch) const = 0;
+
+    // Last sample of channel ch as converted, before the monitor filter [0 - 65535]
+    virtual uint16_t raw(int ch) const = 0;
+
+    // us_ticker time at the start of the last sample
+    virtual uint32_t sampleTime() const = 0;
+
+    // Called after every sample of all channels, in interrupt context (keep it short)
+    virtual void attach(Callback<void()> cb) = 0;
+
+    virtual bool setFilter(int ch, FilterType type, float param) = 0;
+    virtual const Filter& getFilter(int ch) const = 0;
+};
+
+// Source enable outputs, must be safe to use from interrupt context
+class EnableHal
+{
+public:
+    virtual ~EnableHal() {  }
+
+    virtual void write(int source, int value) = 0;
+    virtual int read(int source) = 0;
+};
+
+// Host link, write never blocks and returns how many bytes were taken
+class SerialHal
+{
+public:
+    virtual ~SerialHal() {  }
+
+    virtual bool readable() = 0;
+    virtual uint8_t getc() = 0;
+    virtual int write(const uint8_t* data, int len) = 0;
+
+    // on_rx is called (possibly from an ISR) when new bytes are received, to wake the command thread
+    virtual void attach(Callback<void()> on_rx) = 0;
+};
+
+// LCD link, write never blocks and returns how many bytes were taken
+class LcdHal
+{
+public:
+    virtual ~LcdHal() {  }
+
+    virtual int write(const uint8_t* data, int len) = 0;
+};
+
+class LedHal
+{
+public:
+    virtual ~LedHal() {  }
+
+    virtual void write(float red, float green, float blue) = 0;
+};
+
+// Non volatile key/value storage for small records (calibration)
+class StorageHal
+{
+public:
+    virtual ~StorageHal() {  }
+
+    // False if the key does not exist or its size differs
+    virtual bool load(const char* key, void* data, uint32_t size) = 0;
+    virtual bool store(const char* key, const void* data, uint32_t size) = 0;
+};
+
+struct HVHardware
+{
+    DacHal* dac;
+    AdcHal* adc;
+    EnableHal* en;
+    SerialHal* serial;
+    LcdHal* lcd;
+    LedHal* led;
+    StorageHal* storage;
+};
@@ -0,0 +1,93 @@
+#include "LCDDisplay.h"
+#include <cstring>
+
+static const char* WidgetNames[LCD_NUM_WIDGETS] = {
+    "page0.v1r.val=",
+    "page0.v2r.val=",
+    "page0.i1r.val=",
+    "page0.i2r.val=",
+    "page0.v1t.val=",
+    "page0.v2t.val=",
+    "page0.i1t.val=",
+    "page0.i2t.val="
+};
+
+LCDDisplay::LCDDisplay(TxQueue* queue) : queue(queue), dirty(0), rate(LCD_DEFAULT_RATE), last_refresh(0)
+{
+    for(int i = 0; i < LCD_NUM_WIDGETS; i++)
+    {
+        value[i] = 0;
+        shown[i] = 0;
+    }
+
+    // The LCD state is unknown at boot, send everything once
+    dirty = (1 << LCD_NUM_WIDGETS) - 1;
+}
+
+int LCDDisplay::formatInt(char* buffer, int32_t v)
+{
+    char digits[10];
+    int n = 0;
+    int len = 0;
+    uint32_t u = v < 0 ? -(uint32_t)v : v;
+
+    do
+    {
+        digits[n++] = '0' + (u % 10);
+        u /= 10;
+    } while(u);
+
+    if(v < 0) buffer[len++] = '-';
+    while(n) buffer[len++] = digits[--n];
+    return len;
+}
+
+void LCDDisplay::set(LCDWidget widget, int32_t v)
+{
+    value[widget] = v;
+    if(v != shown[widget]) dirty |= (1 << widget);
+}
+
+bool LCDDisplay::setRate(int rate)
+{
+    if(rate < 1 || rate > LCD_MAX_RATE)
+        return false;
+
+    this->rate = rate;
+    return true;
+}
+
+bool LCDDisplay::send(LCDWidget widget, int32_t v)
+{
+    // Widget name + value + the 3 0xFF terminators of the Nextion protocol
+    char data[32];
+    int len = strlen(WidgetNames[widget]);
+    memcpy(data, WidgetNames[widget], len);
+    len += formatInt(data + len, v);
+    data[len++] = (char)0xFF;
+    data[len++] = (char)0xFF;
+    data[len++] = (char)0xFF;
+
+    return queue->push(data, len);
+}
+
+void LCDDisplay::update(uint32_t now_ms)
+{
+    if(!dirty || (now_ms - last_refresh) < (uint32_t)(1000 / rate))
+        return;
+
+    last_refresh = now_ms;
+
+    for(int i = 0; i < LCD_NUM_WIDGETS; i++)
+    {
+        if(!(dirty & (1 << i)))
+            continue;
+
+        // If the queue is full the widget stays dirty and goes out on the next refresh
+        if(!send((LCDWidget)i, value[i]))
+            break;
+
+        shown[i] = value[i];
+        dirty &= ~(1 << i);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include "TxQueue.h"
+
+// Nextion LCD update engine.
+// Keeps the last value sent to each widget and only sends the ones that changed, at most refresh rate times per second.
+// Commands are written to a TxQueue, the caller drains it into the LCD serial port without blocking.
+
+#define LCD_DEFAULT_RATE 10 // [Hz]
+#define LCD_MAX_RATE 50     // [Hz]
+
+enum LCDWidget
+{
+    LCD_V1R = 0, // Real values
+    LCD_V2R,
+    LCD_I1R,
+    LCD_I2R,
+    LCD_V1T,     // Target values
+    LCD_V2T,
+    LCD_I1T,
+    LCD_I2T,
+    LCD_NUM_WIDGETS
+};
+
+class LCDDisplay
+{
+public:
+    LCDDisplay(TxQueue* queue);
+
+    // Stores the new widget value, it is only sent if it differs from what the LCD shows
+    void set(LCDWidget widget, int32_t value);
+
+    // Sends the changed widgets if the refresh period elapsed
+    void update(uint32_t now_ms);
+
+    bool setRate(int rate);
+    int getRate() const { return rate; }
+
+    // Writes the decimal representation of v to buffer (no terminator), returns the number of chars
+    static int formatInt(char* buffer, int32_t v);
+
+private:
+    bool send(LCDWidget widget, int32_t value);
+
+private:
+    TxQueue* queue;
+
+    int32_t value[LCD_NUM_WIDGETS];
+    int32_t shown[LCD_NUM_WIDGETS];
+    uint8_t dirty; // Bitmask of widgets to send
+
+    int rate;
+    uint32_t last_refresh;
+};
@@ -0,0 +1,12 @@
+#pragma once
+
+// Selects the RTOS/driver primitives the controller logic is built against.
+// The target build uses Mbed OS, the host build (HV_HOST) uses the std based stand-ins in sim/HostPlatform.h.
+
+#ifdef HV_HOST
+#include "sim/HostPlatform.h"
+#else
+#include "mbed.h"
+#include "us_ticker_api.h"
+#include "mbed_stats.h"
+#endif
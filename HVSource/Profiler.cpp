@@ -0,0 +1,39 @@
+#include "Profiler.h"
+
+#ifdef HV_PROFILE
+
+static ProfileStats slots[PROF_NUM_SLOTS];
+
+static const char* const SlotNames[PROF_NUM_SLOTS] = { "onSample", "serialCB", "updateLCD", "ramp", "dacWrite" };
+
+void profileRecord(ProfileSlot slot, uint32_t ticks)
+{
+    CriticalSectionLock lock;
+    ProfileStats& s = slots[slot];
+    if(s.count == 0 || ticks < s.min) s.min = ticks;
+    if(ticks > s.max) s.max = ticks;
+    s.total += ticks;
+    s.count++;
+}
+
+ProfileStats profileGet(ProfileSlot slot)
+{
+    CriticalSectionLock lock;
+    return slots[slot];
+}
+
+const char* profileName(ProfileSlot slot)
+{
+    return SlotNames[slot];
+}
+
+void profileReset()
+{
+    CriticalSectionLock lock;
+    for(ProfileStats& s : slots)
+    {
+        s = ProfileStats{ 0, 0, 0, 0 };
+    }
+}
+
+#endif
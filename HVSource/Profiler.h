@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include "Platform.h"
+
+// Scoped execution time profiling of the hot paths, built only with HV_PROFILE (otherwise PROFILE_SCOPE() is empty).
+// PROFILE_SCOPE(slot) at the top of a block times it until the end of the block : count, min, max and mean per slot.
+// The target counts core cycles (DWT CYCCNT), the host build nanoseconds (std::chrono). Durations must stay under 2^32 ticks.
+// Slots are updated in a short critical section, so the same slot can be timed from several threads and ISRs.
+
+enum ProfileSlot
+{
+    PROF_ON_SAMPLE = 0,     // Acquisition ISR (protection, snapshot, telemetry, recorder)
+    PROF_SERIAL_CB,         // Serial command handling (one pass)
+    PROF_UPDATE_LCD,        // LCD refresh (one pass)
+    PROF_RAMP,              // Ramp thread pass under dac_mutex (sequencer, ramps, conversions and DAC write)
+    PROF_DAC_WRITE,         // Any DAC write (ramp codes, trip, current limits, single channel)
+
+    PROF_NUM_SLOTS
+};
+
+struct ProfileStats
+{
+    uint32_t count;
+    uint32_t min;       // [ticks]
+    uint32_t max;       // [ticks]
+    uint64_t total;     // [ticks]
+};
+
+#ifdef HV_PROFILE
+
+#ifdef HV_HOST
+#include <chrono>
+
+inline void profileInit() {  }
+
+inline uint32_t profileTicks()
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t profileTickRate() { return 1000000000; }
+#else
+// Starts the DWT cycle counter (left running by the debugger too)
+inline void profileInit()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+inline uint32_t profileTicks() { return DWT->CYCCNT; }
+inline uint32_t profileTickRate() { return SystemCoreClock; }
+#endif
+
+void profileRecord(ProfileSlot slot, uint32_t ticks);
+
+// Copy of a slot, count 0 if it never ran
+ProfileStats profileGet(ProfileSlot slot);
+
+const char* profileName(ProfileSlot slot);
+void profileReset();
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(ProfileSlot slot) : slot(slot), start(profileTicks()) {  }
+    ~ProfileScope() { profileRecord(slot, profileTicks() - start); }
+
+private:
+    ProfileSlot slot;
+    uint32_t start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(slot) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(slot)
+
+#else
+
+inline void profileInit() {  }
+
+#define PROFILE_SCOPE(slot)
+
+#endif
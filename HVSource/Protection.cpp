@@ -0,0 +1,130 @@
+#include "Protection.h"
+
+#define PROT_FLAG_TRIP(s) (1 << (s))
+
+static const int CurrentChannel[PROT_NUM_SOURCES] = { ACQ_I1, ACQ_I2 };
+
+Protection::Protection()
+    : adc(nullptr), en(nullptr), events(nullptr), thread(osPriorityRealtime, 1024, nullptr, "protection")
+{
+    for(int i = 0; i < PROT_NUM_SOURCES; i++)
+    {
+        limit_raw[i] = 0;
+        tripped[i] = false;
+        t_sample[i] = 0;
+        index[i] = 0;
+        for(int j = 0; j < PROT_MEDIAN; j++)
+        {
+            history[i][j] = 0;
+            history_t[i][j] = 0;
+        }
+        resetStats(i + 1);
+        stats[i].count = 0;
+    }
+}
+
+void Protection::start(AdcHal* adc, EnableHal* en, Callback<void(int)> on_trip, EventLog* events)
+{
+    this->adc = adc;
+    this->en = en;
+    this->on_trip = on_trip;
+    this->events = events;
+    thread.start(callback(this, &Protection::threadLoop));
+}
+
+void Protection::setLimit(int source, float limit)
+{
+    limit_raw[source - 1] = (int32_t)(limit * 65535.0f / 3.3f);
+}
+
+bool Protection::isTripped(int source) const
+{
+    return tripped[source - 1];
+}
+
+void Protection::clear(int source)
+{
+    tripped[source - 1] = false;
+}
+
+const TripStats& Protection::getStats(int source) const
+{
+    return stats[source - 1];
+}
+
+void Protection::resetStats(int source)
+{
+    stats[source - 1].en_worst_us = 0;
+    stats[source - 1].dac_worst_us = 0;
+}
+
+static uint16_t median3(const uint16_t* x)
+{
+    uint16_t lo = x[0] < x[1] ? x[0] : x[1];
+    uint16_t hi = x[0] < x[1] ? x[1] : x[0];
+    if(x[2] <= lo) return lo;
+    if(x[2] >= hi) return hi;
+    return x[2];
+}
+
+void Protection::check()
+{
+    uint32_t t = adc->sampleTime();
+
+    for(int i = 0; i < PROT_NUM_SOURCES; i++)
+    {
+        // The history follows the samples even while disarmed, so the check starts from the present
+        uint8_t n = index[i];
+        history[i][n] = adc->raw(CurrentChannel[i]);
+        history_t[i][n] = t;
+        index[i] = (n + 1) % PROT_MEDIAN;
+
+        // Only armed while the source is enabled
+        if(tripped[i] || !en->read(i + 1))
+            continue;
+
+        int32_t limit = limit_raw[i];
+        int32_t current = median3(history[i]);
+        if(current > limit)
+        {
+            en->write(i + 1, 0);
+
+            // Latency from the oldest sample of the window over the limit
+            uint32_t ts = t;
+            for(int j = PROT_MEDIAN - 1; j >= 0; j--)
+            {
+                int k = (index[i] + j) % PROT_MEDIAN;
+                if(history[i][k] > limit) ts = history_t[i][k];
+            }
+            uint32_t dt = us_ticker_read() - ts;
+            if(dt > stats[i].en_worst_us) stats[i].en_worst_us = dt;
+
+            t_sample[i] = ts;
+            tripped[i] = true;
+            stats[i].count++;
+
+            // Queued before the protection thread can react to it
+            if(events) events->post(ERR_TRIP, i + 1, i + 1, (int)current);
+            flags.set(PROT_FLAG_TRIP(i));
+        }
+    }
+}
+
+void Protection::threadLoop()
+{
+    while(true)
+    {
+        uint32_t f = flags.wait_any(PROT_FLAG_TRIP(0) | PROT_FLAG_TRIP(1));
+
+        for(int i = 0; i < PROT_NUM_SOURCES; i++)
+        {
+            if(!(f & PROT_FLAG_TRIP(i)))
+                continue;
+
+            on_trip(i + 1);
+
+            uint32_t dt = us_ticker_read() - t_sample[i];
+            if(dt > stats[i].dac_worst_us) stats[i].dac_worst_us = dt;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "HAL.h"
+#include "EventLog.h"
+
+// Over-current protection, runs right after every acquisition sample (ISR context).
+// On a trip the source enable pin is dropped inside the ISR, the DAC is then zeroed by a realtime priority thread.
+// Each source trips independently, latencies are measured from the start of the first sample over the limit.
+// The limit is checked on a median of the last raw current samples, whatever filter the monitors use (FT/FP) :
+// a single sample spike never trips, a real step trips one sample later.
+
+#define PROT_NUM_SOURCES 2
+#define PROT_MEDIAN 3   // Raw samples in the median (median3() in Protection.cpp), not settable
+
+struct TripStats
+{
+    uint32_t count;        // Trips since boot
+    uint32_t en_worst_us;  // Worst first sample over the limit -> enable pin off latency
+    uint32_t dac_worst_us; // Worst first sample over the limit -> DAC zeroed latency
+};
+
+class Protection
+{
+public:
+    Protection();
+
+    // Watches the current monitors of adc and drops the en outputs
+    // on_trip(source) is called from the protection thread to zero the source DAC
+    // Trips are posted to events (ERR_TRIP) right from the ISR, if given
+    void start(AdcHal* adc, EnableHal* en, Callback<void(int)> on_trip, EventLog* events = nullptr);
+
+    // Trip when the current monitor of source goes above limit [V at the ADC pin]
+    void setLimit(int source, float limit);
+
+    bool isTripped(int source) const;
+    void clear(int source);
+
+    const TripStats& getStats(int source) const;
+    void resetStats(int source);
+
+    // Called from the acquisition ISR
+    void check();
+
+private:
+    void threadLoop();
+
+private:
+    AdcHal* adc;
+    EnableHal* en;
+
+    // Limit in raw ADC counts, signed since a limit under the offset always trips
+    volatile int32_t limit_raw[PROT_NUM_SOURCES];
+
+    // Last raw current samples and their times, oldest first from index
+    uint16_t history[PROT_NUM_SOURCES][PROT_MEDIAN];
+    uint32_t history_t[PROT_NUM_SOURCES][PROT_MEDIAN];
+    uint8_t index[PROT_NUM_SOURCES];
+
+    volatile bool tripped[PROT_NUM_SOURCES];
+    uint32_t t_sample[PROT_NUM_SOURCES];
+    TripStats stats[PROT_NUM_SOURCES];
+
+    Callback<void(int)> on_trip;
+    EventLog* events;
+    Thread thread;
+    EventFlags flags;
+};
@@ -0,0 +1,112 @@
+#include "RampEngine.h"
+
+RampEngine::RampEngine(float slew) : last_update(0)
+{
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        state[i].level = 0.0f;
+        state[i].start = 0.0f;
+        state[i].target = 0.0f;
+        state[i].slew = slew;
+        state[i].t_start = 0;
+        state[i].active = false;
+    }
+}
+
+void RampEngine::start(int source, float target, uint64_t now_us)
+{
+    RampState& s = state[source - 1];
+    s.start = s.level;
+    s.target = target;
+    s.t_start = now_us;
+    s.active = (s.level != target);
+}
+
+void RampEngine::setTarget(int source, float target)
+{
+    state[source - 1].target = target;
+}
+
+void RampEngine::reset(int source, float level)
+{
+    RampState& s = state[source - 1];
+    s.level = level;
+    s.start = level;
+    s.active = false;
+}
+
+void RampEngine::setSlew(int source, float slew)
+{
+    RampState& s = state[source - 1];
+
+    // Re-anchor an ongoing ramp so the new rate applies from now on
+    if(s.active)
+    {
+        s.start = s.level;
+        s.t_start = last_update;
+    }
+    s.slew = slew;
+}
+
+float RampEngine::getSlew(int source) const
+{
+    return state[source - 1].slew;
+}
+
+float RampEngine::getLevel(int source) const
+{
+    return state[source - 1].level;
+}
+
+float RampEngine::getTarget(int source) const
+{
+    return state[source - 1].target;
+}
+
+bool RampEngine::isActive(int source) const
+{
+    return state[source - 1].active;
+}
+
+bool RampEngine::anyActive() const
+{
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        if(state[i].active) return true;
+    }
+    return false;
+}
+
+uint8_t RampEngine::update(uint64_t now_us)
+{
+    uint8_t changed = 0;
+    last_update = now_us;
+
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        RampState& s = state[i];
+
+        if(!s.active)
+            continue;
+
+        // The level is computed from the elapsed time and not accumulated per step
+        // This way the ramp duration does not depend on how often update() gets called
+        float dv = s.slew * (float)(now_us - s.t_start) * 1e-6f;
+
+        if(s.target > s.start)
+        {
+            s.level = s.start + dv;
+            if(s.level >= s.target) s.level = s.target;
+        }
+        else
+        {
+            s.level = s.start - dv;
+            if(s.level <= s.target) s.level = s.target;
+        }
+
+        s.active = (s.level != s.target);
+        changed |= (1 << i);
+    }
+
+    return changed;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+// Time driven voltage ramp generator for both HV sources.
+// This class holds no hardware references, the caller is responsible for ticking it periodically
+// and writing the resulting levels into the DAC (see the ramp thread in main.cpp).
+// Sources are numbered [1, 2] like everywhere else in the firmware.
+
+#define RAMP_NUM_SOURCES 2
+
+struct RampState
+{
+    float level;      // Current output level [V]
+    float start;      // Level at the time the ramp started [V]
+    float target;     // Level to reach [V]
+    float slew;       // Rise/Fall rate [V/s]
+    uint64_t t_start; // Ramp start time [us]
+    bool active;
+};
+
+class RampEngine
+{
+public:
+    RampEngine(float slew);
+
+    // Starts ramping source towards target from the current level
+    void start(int source, float target, uint64_t now_us);
+
+    // Sets the target without starting a ramp (used while the source is disabled)
+    void setTarget(int source, float target);
+
+    // Stops the ramp and forces the level (no ramp is performed)
+    void reset(int source, float level);
+
+    void setSlew(int source, float slew);
+
+    float getSlew(int source) const;
+    float getLevel(int source) const;
+    float getTarget(int source) const;
+    bool isActive(int source) const;
+    bool anyActive() const;
+
+    // Advances all the active ramps to now_us
+    // Returns a bitmask of the sources whose level changed (bit 0 -> source 1)
+    uint8_t update(uint64_t now_us);
+
+private:
+    RampState state[RAMP_NUM_SOURCES];
+    uint64_t last_update;
+};
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+// Single producer / single consumer lock-free ring buffer.
+// The producer (usually an ISR) never blocks, when full the oldest sample is overwritten.
+// N must be a power of 2.
+template<typename T, uint32_t N>
+class RingBuffer
+{
+    static_assert((N & (N - 1)) == 0, "RingBuffer size must be a power of 2.");
+
+public:
+    RingBuffer() : head(0), tail(0) {  }
+
+    // Producer side
+    void push(const T& v)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        data[h & (N - 1)] = v;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // Consumer side, returns false when empty
+    bool pop(T& v)
+    {
+        uint32_t h = head.load(std::memory_order_acquire);
+        uint32_t t = tail.load(std::memory_order_relaxed);
+
+        if(h == t)
+            return false;
+
+        // Skip whatever the producer overwrote meanwhile
+        if(h - t > N)
+            t = h - N;
+
+        v = data[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Last value pushed (O(1), does not consume)
+    T latest() const
+    {
+        uint32_t h = head.load(std::memory_order_acquire);
+        return data[(h - 1) & (N - 1)];
+    }
+
+    uint32_t count() const
+    {
+        uint32_t d = head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+        return d > N ? N : d;
+    }
+
+    // Total number of values ever pushed
+    uint32_t pushed() const
+    {
+        return head.load(std::memory_order_acquire);
+    }
+
+private:
+    T data[N];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+};
@@ -0,0 +1,191 @@
+#include "Sequencer.h"
+#include <cmath>
+
+Sequencer::Sequencer()
+{
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        Channel& c = channels[i];
+        c.count = 0;
+        c.state = SEQ_IDLE;
+        c.index = 0;
+        c.phase = SEQ_PHASE_RAMP;
+        c.t_end = 0;
+        c.remaining_us = 0;
+        c.user_slew = 0.0f;
+    }
+}
+
+bool Sequencer::add(int source, const SeqSegment& segment)
+{
+    Channel& c = channels[source - 1];
+    if(isActive(source) || c.count >= SEQ_MAX_SEGMENTS)
+        return false;
+
+    c.segments[c.count++] = segment;
+    c.state = SEQ_IDLE;
+    return true;
+}
+
+bool Sequencer::clear(int source)
+{
+    if(isActive(source))
+        return false;
+
+    channels[source - 1].count = 0;
+    channels[source - 1].state = SEQ_IDLE;
+    return true;
+}
+
+int Sequencer::count(int source) const
+{
+    return channels[source - 1].count;
+}
+
+const SeqSegment& Sequencer::segment(int source, int index) const
+{
+    return channels[source - 1].segments[index];
+}
+
+// Ramp time from level to the target of the current segment [us]
+static uint64_t rampTime(float level, const SeqSegment& s)
+{
+    return (uint64_t)(fabsf(s.target - level) / s.slew * 1e6f);
+}
+
+// Starts the ramp of the current segment as if at t_us (the scheduled time, at most a tick in the past)
+void Sequencer::startSegment(int source, RampEngine& ramp, uint64_t t_us)
+{
+    Channel& c = channels[source - 1];
+    const SeqSegment& s = c.segments[c.index];
+
+    c.phase = SEQ_PHASE_RAMP;
+    c.t_end = t_us + rampTime(ramp.getLevel(source), s);
+    ramp.setSlew(source, s.slew);
+    ramp.start(source, s.target, t_us);
+}
+
+bool Sequencer::start(int source, RampEngine& ramp, uint64_t now_us)
+{
+    Channel& c = channels[source - 1];
+    if(isActive(source) || c.count == 0)
+        return false;
+
+    c.user_slew = ramp.getSlew(source);
+    c.index = 0;
+    c.state = SEQ_RUNNING;
+    startSegment(source, ramp, now_us);
+    return true;
+}
+
+bool Sequencer::pause(int source, RampEngine& ramp, uint64_t now_us)
+{
+    Channel& c = channels[source - 1];
+    if(c.state != SEQ_RUNNING)
+        return false;
+
+    // Hold the level the ramp is at
+    if(c.phase == SEQ_PHASE_RAMP) ramp.start(source, ramp.getLevel(source), now_us);
+    else                          c.remaining_us = c.t_end > now_us ? c.t_end - now_us : 0;
+
+    c.state = SEQ_PAUSED;
+    return true;
+}
+
+bool Sequencer::resume(int source, RampEngine& ramp, uint64_t now_us)
+{
+    Channel& c = channels[source - 1];
+    if(c.state != SEQ_PAUSED)
+        return false;
+
+    c.state = SEQ_RUNNING;
+    if(c.phase == SEQ_PHASE_RAMP) startSegment(source, ramp, now_us);
+    else                          c.t_end = now_us + c.remaining_us;
+    return true;
+}
+
+void Sequencer::finish(int source, RampEngine& ramp, SeqState state)
+{
+    Channel& c = channels[source - 1];
+    c.state = state;
+    ramp.setSlew(source, c.user_slew);
+}
+
+bool Sequencer::stop(int source, RampEngine& ramp, SeqState reason)
+{
+    if(!isActive(source))
+        return false;
+
+    finish(source, ramp, reason);
+    return true;
+}
+
+void Sequencer::update(RampEngine& ramp, uint64_t now_us)
+{
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        Channel& c = channels[i];
+
+        // Several phases may end within one tick (zero holds, short ramps)
+        while(c.state == SEQ_RUNNING && now_us >= c.t_end)
+        {
+            if(c.phase == SEQ_PHASE_RAMP)
+            {
+                c.phase = SEQ_PHASE_HOLD;
+                c.t_end += (uint64_t)c.segments[c.index].hold_ms * 1000;
+            }
+            else if(c.index + 1 < c.count)
+            {
+                // The ramp engine may be a tick behind, the next ramp starts from this target at the scheduled time
+                ramp.reset(i + 1, c.segments[c.index].target);
+                c.index++;
+                startSegment(i + 1, ramp, c.t_end);
+            }
+            else
+            {
+                finish(i + 1, ramp, SEQ_DONE);
+            }
+        }
+    }
+}
+
+bool Sequencer::isActive(int source) const
+{
+    SeqState s = channels[source - 1].state;
+    return s == SEQ_RUNNING || s == SEQ_PAUSED;
+}
+
+bool Sequencer::anyRunning() const
+{
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        if(channels[i].state == SEQ_RUNNING) return true;
+    }
+    return false;
+}
+
+uint64_t Sequencer::nextEvent() const
+{
+    uint64_t next = 0;
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        const Channel& c = channels[i];
+        if(c.state == SEQ_RUNNING && (next == 0 || c.t_end < next)) next = c.t_end;
+    }
+    return next;
+}
+
+SeqProgress Sequencer::progress(int source, uint64_t now_us) const
+{
+    const Channel& c = channels[source - 1];
+
+    SeqProgress p;
+    p.state = c.state;
+    p.segment = c.index;
+    p.count = c.count;
+    p.phase = c.phase;
+    p.remaining_ms = 0;
+    if(c.state == SEQ_RUNNING && c.t_end > now_us) p.remaining_ms = (uint32_t)((c.t_end - now_us) / 1000);
+    else if(c.state == SEQ_PAUSED && c.phase == SEQ_PHASE_HOLD) p.remaining_ms = (uint32_t)(c.remaining_us / 1000);
+    return p;
+}
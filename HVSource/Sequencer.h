@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+#include "RampEngine.h"
+
+// Voltage profiles run on the device : each source steps through a list of segments (ramp to a target at a slew rate, then hold).
+// Like RampEngine this holds no hardware references. The control thread calls update() on every ramp tick,
+// the segments then drive the ramp engine, whose lock (dac_mutex) must be held for every call.
+// Segment times are computed from the ramp start and slew rate, not from when the tick notices them,
+// so a profile does not drift with the tick period. The source keeps the last target at the end.
+
+#define SEQ_MAX_SEGMENTS 16
+#define SEQ_MAX_HOLD_MS 86400000 // 24 h
+
+struct SeqSegment
+{
+    float target;       // [V]
+    float slew;         // [V/s]
+    uint32_t hold_ms;   // Time at target before the next segment
+};
+
+enum SeqState : uint8_t
+{
+    SEQ_IDLE    = 0,    // Never started (or segments changed since)
+    SEQ_RUNNING = 1,
+    SEQ_PAUSED  = 2,
+    SEQ_DONE    = 3,
+    SEQ_ABORTED = 4,    // Stopped by the host (abort, new voltage or power off)
+    SEQ_TRIPPED = 5     // Stopped by an over-current trip
+};
+
+enum SeqPhase : uint8_t
+{
+    SEQ_PHASE_RAMP = 0,
+    SEQ_PHASE_HOLD = 1
+};
+
+struct SeqProgress
+{
+    SeqState state;
+    uint8_t segment;    // Current segment (0 - first)
+    uint8_t count;      // Segments in the profile
+    SeqPhase phase;
+    uint32_t remaining_ms; // Left in the current phase (ramp or hold)
+};
+
+class Sequencer
+{
+public:
+    Sequencer();
+
+    // Profile edition, refused while running or paused
+    bool add(int source, const SeqSegment& segment);
+    bool clear(int source);
+    int count(int source) const;
+    const SeqSegment& segment(int source, int index) const;
+
+    // Starts from the current ramp level, returns false if there are no segments or already running
+    bool start(int source, RampEngine& ramp, uint64_t now_us);
+
+    // Pause freezes the ramp where it is (or the hold timer), resume continues the segment
+    bool pause(int source, RampEngine& ramp, uint64_t now_us);
+    bool resume(int source, RampEngine& ramp, uint64_t now_us);
+
+    // Ends a running or paused profile with reason (SEQ_ABORTED or SEQ_TRIPPED), the ramp is left to the caller
+    // Returns false if it was not running
+    bool stop(int source, RampEngine& ramp, SeqState reason);
+
+    // Advances the running profiles to now_us, starting the ramp of the next segment when a hold ends
+    void update(RampEngine& ramp, uint64_t now_us);
+
+    bool isActive(int source) const;  // Running or paused
+    bool anyRunning() const;
+
+    // Earliest end of a running phase (ramp or hold) [us], 0 if no profile is running.
+    // Between ramps the control thread sleeps until then instead of ticking.
+    uint64_t nextEvent() const;
+
+    SeqProgress progress(int source, uint64_t now_us) const;
+
+private:
+    struct Channel
+    {
+        SeqSegment segments[SEQ_MAX_SEGMENTS];
+        uint8_t count;
+        SeqState state;
+        uint8_t index;
+        SeqPhase phase;
+        uint64_t t_end;         // End of the current phase [us]
+        uint64_t remaining_us;  // Hold left while paused
+        float user_slew;        // Ramp slew before the start, restored at the end
+    };
+
+    void startSegment(int source, RampEngine& ramp, uint64_t t_us);
+    void finish(int source, RampEngine& ramp, SeqState state);
+
+private:
+    Channel channels[RAMP_NUM_SOURCES];
+};
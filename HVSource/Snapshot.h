@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+// Single writer / many readers snapshot of a plain struct (double buffered seqlock).
+// The writer (usually an ISR) never blocks and never waits for the readers.
+// It fills the buffer readers are not directed to, then bumps the sequence number.
+// A read is a copy of the current buffer. It only retries if the writer published twice
+// during the copy, i.e. the reader was preempted for a whole publish period.
+// T must be trivially copyable.
+template<typename T>
+class Snapshot
+{
+public:
+    Snapshot() : seq(0), data{} {  }
+
+    // Writer side
+    void publish(const T& v)
+    {
+        uint32_t next = seq.load(std::memory_order_relaxed) + 1;
+        data[next & 1] = v;
+        seq.store(next, std::memory_order_release);
+    }
+
+    // Reader side, any thread
+    void read(T& v) const
+    {
+        while(true)
+        {
+            uint32_t s = seq.load(std::memory_order_acquire);
+            v = data[s & 1];
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // The buffer just copied is only rewritten by the second publish after s
+            if(seq.load(std::memory_order_relaxed) - s < 2)
+                return;
+        }
+    }
+
+    // Number of snapshots published so far
+    uint32_t published() const
+    {
+        return seq.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<uint32_t> seq;
+    T data[2];
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include "HAL.h"
+
+// Coherent view of both sources, published by the acquisition ISR after every sample (see Snapshot.h).
+// Queries, the LCD and the telemetry all read it instead of the drivers, so they see the same instant.
+// The monitors are kept in raw counts, consumers convert them with the calibration of their choice.
+// Arrays indexed by source are [source - 1].
+
+struct SourceState
+{
+    uint32_t t_us;                   // Time of the sample (us ticker)
+    uint16_t mon[ACQ_NUM_CHANNELS];  // Filtered monitors [ADC counts], ACQ_I1 ... ACQ_V2
+
+    uint8_t en[2];                   // Enable pins
+    uint8_t tripped[2];              // Over-current trips (checked on this same sample)
+    uint8_t ramping[2];              // Voltage ramp in progress
+
+    float target_v[2];               // Voltage setpoint [V]
+    float level_v[2];                // Voltage the ramp is at [V]
+    float limit_ua[2];               // Current limit [uA]
+};
@@ -0,0 +1,53 @@
+#include "Telemetry.h"
+
+Telemetry::Telemetry(uint32_t sample_rate)
+    : sample_rate(sample_rate), divider(0), counter(0), mask(TELEMETRY_ALL), drops(0)
+{
+
+}
+
+bool Telemetry::setRate(float rate)
+{
+    if(rate < 0.0f || rate > TELEMETRY_MAX_RATE)
+        return false;
+
+    // Rounded to the closest integer divider of the acquisition rate
+    divider = (rate > 0.0f) ? (uint32_t)(sample_rate / rate + 0.5f) : 0;
+    counter = 0;
+    return true;
+}
+
+float Telemetry::getRate() const
+{
+    uint32_t d = divider;
+    return d ? (float)sample_rate / d : 0.0f;
+}
+
+bool Telemetry::due()
+{
+    uint32_t d = divider;
+    if(d == 0 || ++counter < d)
+        return false;
+
+    counter = 0;
+    return true;
+}
+
+void Telemetry::record(uint32_t t_us, const uint16_t* mon, uint8_t flags)
+{
+    // Never overwrite samples the consumer did not send yet, count them instead
+    if(queue.count() >= TELEMETRY_QUEUE_SIZE)
+    {
+        drops++;
+        return;
+    }
+
+    TelemetrySample s;
+    s.t_us = t_us;
+    for(int i = 0; i < 4; i++)
+    {
+        s.mon[i] = mon[i];
+    }
+    s.flags = flags;
+    queue.push(s);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include "RingBuffer.h"
+
+// Unsolicited monitor streaming.
+// The acquisition ISR calls due() on every sample and record() on the ones to keep (one every rate divider samples).
+// This keeps the streamed samples evenly spaced, the formatting happens later on the consumer side.
+
+#define TELEMETRY_QUEUE_SIZE 64
+#define TELEMETRY_MAX_RATE 500 // [Hz]
+
+// Channel mask bits
+#define TELEMETRY_V1    0x01
+#define TELEMETRY_I1    0x02
+#define TELEMETRY_V2    0x04
+#define TELEMETRY_I2    0x08
+#define TELEMETRY_STATE 0x10 // Enable states and trip flags
+#define TELEMETRY_ALL   0x1F
+
+// State flags bits
+#define TELEMETRY_EN1   0x01
+#define TELEMETRY_EN2   0x02
+#define TELEMETRY_TRIP1 0x04
+#define TELEMETRY_TRIP2 0x08
+
+struct TelemetrySample
+{
+    uint32_t t_us;      // us_ticker time of the sample
+    uint16_t mon[4];    // Filtered monitors (I1, V1, I2, V2 - acquisition channel order)
+    uint8_t flags;
+};
+
+class Telemetry
+{
+public:
+    Telemetry(uint32_t sample_rate);
+
+    // rate [Hz], 0 - off. Returns false if out of range
+    bool setRate(float rate);
+    float getRate() const;
+
+    void setMask(uint8_t mask) { this->mask = mask; }
+    uint8_t getMask() const { return mask; }
+
+    // Producer side (ISR)
+    bool due();
+    void record(uint32_t t_us, const uint16_t* mon, uint8_t flags);
+
+    // Consumer side
+    bool pop(TelemetrySample& s) { return queue.pop(s); }
+
+    uint32_t dropped() const { return drops; }
+
+private:
+    uint32_t sample_rate;
+    volatile uint32_t divider; // 0 - off
+    uint32_t counter;
+    volatile uint8_t mask;
+    volatile uint32_t drops;
+
+    RingBuffer<TelemetrySample, TELEMETRY_QUEUE_SIZE> queue;
+};
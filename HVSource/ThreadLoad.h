@@ -0,0 +1,50 @@
+#pragma once
+#include "Platform.h"
+
+// CPU time used by a thread, measured with the us ticker around each pass of its loop (begin() / end()).
+// Mbed OS only reports the CPU use of the whole system, this gives the share of each controller thread.
+// The load is the busy time over the time since the last reset, both in us.
+
+class ThreadLoad
+{
+public:
+    ThreadLoad() : busy_us(0), t_begin(0), t_reset(0) {  }
+
+    void begin()
+    {
+        t_begin = us_ticker_read();
+    }
+
+    void end()
+    {
+        uint32_t dt = us_ticker_read() - t_begin;
+
+        // 64 bit counter, keep the readers out while it is updated
+        CriticalSectionLock lock;
+        busy_us += dt;
+    }
+
+    // [%] of the CPU since reset(), now_us on the same time base as reset()
+    float percent(uint64_t now_us) const
+    {
+        uint64_t busy;
+        {
+            CriticalSectionLock lock;
+            busy = busy_us;
+        }
+        uint64_t window = now_us - t_reset;
+        return window > 0 ? busy * 100.0f / window : 0.0f;
+    }
+
+    void reset(uint64_t now_us)
+    {
+        CriticalSectionLock lock;
+        busy_us = 0;
+        t_reset = now_us;
+    }
+
+private:
+    uint64_t busy_us;
+    uint32_t t_begin;
+    uint64_t t_reset;
+};
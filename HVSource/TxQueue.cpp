@@ -0,0 +1,41 @@
+#include "TxQueue.h"
+#include <cstring>
+
+TxQueue::TxQueue() : head(0), tail(0), used(0), drops(0)
+{
+
+}
+
+bool TxQueue::push(const void* data, int len)
+{
+    if(len > free())
+    {
+        drops++;
+        return false;
+    }
+
+    const uint8_t* src = (const uint8_t*)data;
+    int first = TX_QUEUE_SIZE - head;
+    if(first > len) first = len;
+
+    memcpy(&buffer[head], src, first);
+    memcpy(&buffer[0], src + first, len - first);
+
+    head = (head + len) % TX_QUEUE_SIZE;
+    used += len;
+    return true;
+}
+
+int TxQueue::peek(const uint8_t** data) const
+{
+    *data = &buffer[tail];
+    int contiguous = TX_QUEUE_SIZE - tail;
+    return used < contiguous ? used : contiguous;
+}
+
+void TxQueue::pop(int len)
+{
+    if(len > used) len = used;
+    tail = (tail + len) % TX_QUEUE_SIZE;
+    used -= len;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+
+// Bounded byte queue for everything sent to the host.
+// Records are queued whole or not at all, so a drained stream never holds partial records.
+// Producers that can afford to lose data (telemetry) use push(), the dropped records are counted.
+
+#define TX_QUEUE_SIZE 2048
+
+class TxQueue
+{
+public:
+    TxQueue();
+
+    // Queues len bytes, returns false (and counts a drop) if they don't fit
+    bool push(const void* data, int len);
+
+    // Contiguous block of queued data, returns its length (0 if empty)
+    int peek(const uint8_t** data) const;
+
+    // Removes len bytes from the front (after they were sent)
+    void pop(int len);
+
+    int free() const { return TX_QUEUE_SIZE - used; }
+    int size() const { return used; }
+    uint32_t dropped() const { return drops; }
+
+private:
+    uint8_t buffer[TX_QUEUE_SIZE];
+    int head;
+    int tail;
+    int used;
+    uint32_t drops;
+};
@@ -0,0 +1,410 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <type_traits>
+#include <algorithm>
+#include <vector>
+#include <ctime>
+
+// Minimal stand-ins for the Mbed OS primitives used by the controller logic, so it builds and runs on Linux.
+// Threads are std::threads (priorities are ignored), tickers run their callback on their own thread.
+// Interrupt context is emulated with a single global recursive lock : ticker callbacks and critical sections
+// take it, so a critical section keeps the "ISRs" out like on the target.
+
+using namespace std::chrono_literals;
+
+inline std::recursive_mutex& hostIsrLock()
+{
+    static std::recursive_mutex lock;
+    return lock;
+}
+
+inline void core_util_critical_section_enter()
+{
+    hostIsrLock().lock();
+}
+
+inline void core_util_critical_section_exit()
+{
+    hostIsrLock().unlock();
+}
+
+class CriticalSectionLock
+{
+public:
+    CriticalSectionLock() { core_util_critical_section_enter(); }
+    ~CriticalSectionLock() { core_util_critical_section_exit(); }
+};
+
+// Microseconds since the program started, wraps like the target ticker
+inline uint32_t us_ticker_read()
+{
+    static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+inline void wait_us(int us)
+{
+    // Busy wait like the target, sleeping is far too coarse for the DAC settling times
+    uint32_t start = us_ticker_read();
+    while((uint32_t)(us_ticker_read() - start) < (uint32_t)us) {  }
+}
+
+template<typename F>
+class Callback;
+
+template<typename R, typename... Args>
+class Callback<R(Args...)>
+{
+public:
+    Callback() {  }
+
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Callback>::value>::type>
+    Callback(F f) : fn(f) {  }
+
+    template<typename T>
+    Callback(T* obj, R (T::*method)(Args...)) : fn([obj, method](Args... args) { return (obj->*method)(args...); }) {  }
+
+    R operator()(Args... args) const { return fn(args...); }
+    R call(Args... args) const { return fn(args...); }
+    explicit operator bool() const { return (bool)fn; }
+
+private:
+    std::function<R(Args...)> fn;
+};
+
+template<typename R, typename... Args>
+Callback<R(Args...)> callback(R (*f)(Args...))
+{
+    return Callback<R(Args...)>(f);
+}
+
+template<typename T, typename R, typename... Args>
+Callback<R(Args...)> callback(T* obj, R (T::*method)(Args...))
+{
+    return Callback<R(Args...)>(obj, method);
+}
+
+enum osPriority
+{
+    osPriorityIdle = 1,
+    osPriorityLow = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh = 40,
+    osPriorityRealtime = 48
+};
+
+enum osStatus
+{
+    osOK = 0,
+    osError = -1
+};
+
+#define osWaitForever 0xFFFFFFFFU
+#define osFlagsError 0x80000000U
+#define osFlagsErrorTimeout 0xFFFFFFFEU
+
+namespace Kernel
+{
+    struct Clock
+    {
+        using duration_u32 = std::chrono::duration<uint32_t, std::milli>;
+    };
+
+    constexpr Clock::duration_u32 wait_for_u32_forever{osWaitForever};
+}
+
+namespace ThisThread
+{
+    template<typename Rep, typename Period>
+    void sleep_for(std::chrono::duration<Rep, Period> d)
+    {
+        std::this_thread::sleep_for(d);
+    }
+}
+
+class Mutex
+{
+public:
+    void lock() { m.lock(); }
+    void unlock() { m.unlock(); }
+    bool trylock() { return m.try_lock(); }
+
+private:
+    std::recursive_mutex m;
+};
+
+class Thread;
+
+// Started threads, for the mbed_stats_thread_get_each() stand-in
+inline std::vector<Thread*>& hostThreads(std::unique_lock<std::mutex>& lock)
+{
+    static std::mutex m;
+    static std::vector<Thread*> threads;
+    lock = std::unique_lock<std::mutex>(m);
+    return threads;
+}
+
+class Thread
+{
+public:
+    Thread(osPriority priority = osPriorityNormal, uint32_t stack_size = 4096, unsigned char* mem = nullptr, const char* name = nullptr)
+        : priority(priority), stack(stack_size), name(name)
+    {
+
+    }
+
+    ~Thread()
+    {
+        std::unique_lock<std::mutex> lock;
+        std::vector<Thread*>& threads = hostThreads(lock);
+        threads.erase(std::remove(threads.begin(), threads.end(), this), threads.end());
+    }
+
+    // Firmware threads never return, they are left running until the process exits
+    osStatus start(Callback<void()> task)
+    {
+        {
+            std::unique_lock<std::mutex> lock;
+            hostThreads(lock).push_back(this);
+        }
+        std::thread(task).detach();
+        return osOK;
+    }
+
+    osPriority get_priority() const { return priority; }
+    uint32_t stack_size() const { return stack; }
+    const char* get_name() const { return name; }
+
+private:
+    osPriority priority;
+    uint32_t stack;
+    const char* name;
+};
+
+class EventFlags
+{
+public:
+    EventFlags() : flags(0) {  }
+
+    uint32_t set(uint32_t f)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        flags |= f;
+        cv.notify_all();
+        return flags;
+    }
+
+    uint32_t clear(uint32_t f = 0x7FFFFFFF)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        uint32_t old = flags;
+        flags &= ~f;
+        return old;
+    }
+
+    uint32_t get()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return flags;
+    }
+
+    uint32_t wait_any(uint32_t f, uint32_t millisec = osWaitForever, bool clear = true)
+    {
+        return wait(f, millisec, clear, false);
+    }
+
+    uint32_t wait_all(uint32_t f, uint32_t millisec = osWaitForever, bool clear = true)
+    {
+        return wait(f, millisec, clear, true);
+    }
+
+    uint32_t wait_any_for(uint32_t f, Kernel::Clock::duration_u32 rel_time, bool clear = true)
+    {
+        return wait(f, rel_time.count(), clear, false);
+    }
+
+    uint32_t wait_all_for(uint32_t f, Kernel::Clock::duration_u32 rel_time, bool clear = true)
+    {
+        return wait(f, rel_time.count(), clear, true);
+    }
+
+private:
+    uint32_t wait(uint32_t f, uint32_t millisec, bool clear, bool all)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        auto ready = [&]() { return all ? (flags & f) == f : (flags & f) != 0; };
+
+        if(millisec == osWaitForever)
+        {
+            cv.wait(lock, ready);
+        }
+        else if(!cv.wait_for(lock, std::chrono::milliseconds(millisec), ready))
+        {
+            return osFlagsErrorTimeout;
+        }
+
+        uint32_t old = flags;
+        if(clear) flags &= ~f;
+        return old;
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable cv;
+    uint32_t flags;
+};
+
+class Timer
+{
+public:
+    Timer() : running(false), acc(0) {  }
+
+    void start()
+    {
+        if(running) return;
+        t0 = std::chrono::steady_clock::now();
+        running = true;
+    }
+
+    void stop()
+    {
+        if(!running) return;
+        acc += now();
+        running = false;
+    }
+
+    void reset()
+    {
+        acc = std::chrono::microseconds(0);
+        t0 = std::chrono::steady_clock::now();
+    }
+
+    std::chrono::microseconds elapsed_time() const
+    {
+        return running ? acc + now() : acc;
+    }
+
+private:
+    std::chrono::microseconds now() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0);
+    }
+
+private:
+    bool running;
+    std::chrono::steady_clock::time_point t0;
+    std::chrono::microseconds acc;
+};
+
+class Ticker
+{
+public:
+    Ticker() : generation(0) {  }
+    ~Ticker() { detach(); }
+
+    template<typename Rep, typename Period>
+    void attach(Callback<void()> cb, std::chrono::duration<Rep, Period> period)
+    {
+        detach();
+        uint32_t gen = ++generation;
+        std::chrono::microseconds us = std::chrono::duration_cast<std::chrono::microseconds>(period);
+        worker = std::thread(&Ticker::run, this, cb, us, gen);
+    }
+
+    void detach()
+    {
+        generation++;
+        if(worker.joinable())
+        {
+            // Detaching from the ticker callback itself, the thread ends after the callback returns
+            if(worker.get_id() == std::this_thread::get_id()) worker.detach();
+            else                                              worker.join();
+        }
+    }
+
+private:
+    void run(Callback<void()> cb, std::chrono::microseconds period, uint32_t gen)
+    {
+        std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now() + period;
+
+        while(generation == gen)
+        {
+            std::this_thread::sleep_until(next);
+            if(generation != gen)
+                break;
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(hostIsrLock());
+                cb();
+            }
+
+            // Keep the average rate, but don't try to catch up after a long stall (debugger, loaded CI machine)
+            next += period;
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if(now - next > 10 * period) next = now + period;
+        }
+    }
+
+private:
+    std::atomic<uint32_t> generation;
+    std::thread worker;
+};
+
+// mbed_stats stand-ins : the thread list comes from the started Threads, the stack use is not measured (reported unused)
+// and the idle time is the wall time not spent on the CPU by the process
+struct mbed_stats_thread_t
+{
+    uint32_t id;
+    uint32_t state;
+    uint32_t priority;
+    uint32_t stack_size;
+    uint32_t stack_space;
+    const char* name;
+};
+
+struct mbed_stats_cpu_t
+{
+    uint64_t uptime;
+    uint64_t idle_time;
+    uint64_t sleep_time;
+    uint64_t deep_sleep_time;
+};
+
+inline size_t mbed_stats_thread_get_each(mbed_stats_thread_t* stats, size_t count)
+{
+    std::unique_lock<std::mutex> lock;
+    std::vector<Thread*>& threads = hostThreads(lock);
+
+    size_t n = 0;
+    for(; n < count && n < threads.size(); n++)
+    {
+        stats[n].id = n + 1;
+        stats[n].state = 0;
+        stats[n].priority = threads[n]->get_priority();
+        stats[n].stack_size = threads[n]->stack_size();
+        stats[n].stack_space = threads[n]->stack_size();
+        stats[n].name = threads[n]->get_name() ? threads[n]->get_name() : "";
+    }
+    return n;
+}
+
+inline void mbed_stats_cpu_get(mbed_stats_cpu_t* stats)
+{
+    uint64_t uptime = us_ticker_read();
+    uint64_t busy = (uint64_t)clock() * 1000000 / CLOCKS_PER_SEC;
+
+    stats->uptime = uptime;
+    stats->idle_time = busy < uptime ? uptime - busy : 0;
+    stats->sleep_time = 0;
+    stats->deep_sleep_time = 0;
+}
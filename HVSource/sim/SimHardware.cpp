@@ -0,0 +1,502 @@
+#include "SimHardware.h"
+#include <cmath>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Inverse of convertV() and convertVmon() in Controller.cpp
+static float refToVolts(float ref)
+{
+    return (ref + 0.003413f) / 0.9095f;
+}
+
+static float voltsToVmon(float v)
+{
+    return (v - 0.721925f) / 1096.475f;
+}
+
+// averageI() reads the current monitor pin times 253
+static float currentToImon(float ua)
+{
+    return ua / 253.0f;
+}
+
+SimDac::SimDac() : count(0)
+{
+    for(int i = 0; i < DAC_NUM_CHANNELS; i++)
+    {
+        ref[i] = 0.0f;
+    }
+    clearChanges();
+}
+
+void SimDac::init()
+{
+
+}
+
+void SimDac::clearChanges()
+{
+    for(int i = 0; i < DAC_NUM_CHANNELS; i++)
+    {
+        change_count[i] = 0;
+        first_change[i] = 0;
+        last_change[i] = 0;
+    }
+}
+
+void SimDac::set(int channel, float value, uint32_t t_us)
+{
+    if(ref[channel] != value)
+    {
+        if(change_count[channel]++ == 0) first_change[channel] = t_us;
+        last_change[channel] = t_us;
+    }
+    ref[channel] = value;
+}
+
+void SimDac::write(int channel, float ref)
+{
+    set(channel, ref, us_ticker_read());
+    count++;
+}
+
+void SimDac::writeBatch(const float* ref, uint8_t mask)
+{
+    uint32_t t_us = us_ticker_read();
+    for(int i = 0; i < DAC_NUM_CHANNELS; i++)
+    {
+        if(mask & (1 << i)) set(i, ref[i], t_us);
+    }
+    count++;
+}
+
+void SimDac::writeCodes(const uint16_t* code, uint8_t mask)
+{
+    uint32_t t_us = us_ticker_read();
+    for(int i = 0; i < DAC_NUM_CHANNELS; i++)
+    {
+        if(mask & (1 << i)) set(i, code[i] * ((float)DAC_VREF_MV / DAC_RESOLUTION), t_us);
+    }
+    count++;
+}
+
+float SimDac::get(int channel) const
+{
+    return ref[channel];
+}
+
+SimEnable::SimEnable()
+{
+    en[0] = 0;
+    en[1] = 0;
+}
+
+void SimEnable::write(int source, int value)
+{
+    en[source - 1] = value ? 1 : 0;
+}
+
+int SimEnable::read(int source)
+{
+    return en[source - 1];
+}
+
+SimAdc::SimAdc(SimDac* dac, SimEnable* en)
+    : dac(dac), en(en), tau_ms(SIM_DEFAULT_TAU_MS), noise(SIM_DEFAULT_NOISE), rng(1234), t_sample(0)
+{
+    for(int i = 0; i < ACQ_NUM_CHANNELS; i++)
+    {
+        filter[i].configure(FILTER_AVERAGE, FILTER_DEFAULT_AVERAGE, ACQ_RATE_HZ);
+        last[i] = 0;
+    }
+
+    for(int i = 0; i < 2; i++)
+    {
+        vout[i] = 0.0f;
+        load[i] = SIM_DEFAULT_LOAD;
+    }
+}
+
+void SimAdc::start()
+{
+    ticker.attach(callback(this, &SimAdc::sample), std::chrono::microseconds(1000000 / ACQ_RATE_HZ));
+}
+
+float SimAdc::read(int ch) const
+{
+    return filter[ch].output() * (3.3f / 65535.0f);
+}
+
+uint16_t SimAdc::filtered(int ch) const
+{
+    return filter[ch].output();
+}
+
+uint16_t SimAdc::raw(int ch) const
+{
+    return last[ch];
+}
+
+uint32_t SimAdc::sampleTime() const
+{
+    return t_sample;
+}
+
+void SimAdc::attach(Callback<void()> cb)
+{
+    on_sample = cb;
+}
+
+bool SimAdc::setFilter(int ch, FilterType type, float param)
+{
+    Filter f;
+    if(!f.configure(type, param, ACQ_RATE_HZ))
+        return false;
+
+    CriticalSectionLock lock;
+    // Carry on from the current output instead of starting over from 0
+    if(filter[ch].isSeeded()) f.seed(filter[ch].output());
+    filter[ch] = f;
+    return true;
+}
+
+const Filter& SimAdc::getFilter(int ch) const
+{
+    return filter[ch];
+}
+
+void SimAdc::setTau(float ms)
+{
+    tau_ms = ms;
+}
+
+void SimAdc::setNoise(float counts)
+{
+    noise = counts;
+}
+
+void SimAdc::setLoad(int source, float mohm)
+{
+    load[source - 1] = mohm;
+}
+
+float SimAdc::output(int source) const
+{
+    CriticalSectionLock lock;
+    return vout[source - 1];
+}
+
+uint16_t SimAdc::toCounts(float v)
+{
+    float n = noise;
+    float counts = v * (65535.0f / 3.3f);
+    if(n > 0.0f) counts += std::normal_distribution<float>(0.0f, n)(rng);
+
+    if(counts < 0.0f) return 0;
+    if(counts > 65535.0f) return 65535;
+    return (uint16_t)counts;
+}
+
+void SimAdc::sample()
+{
+    t_sample = us_ticker_read();
+
+    // Exact first order step over one sample period
+    const float dt_ms = 1000.0f / ACQ_RATE_HZ;
+    float t = tau_ms;
+    float alpha = (t > 0.0f) ? 1.0f - std::exp(-dt_ms / t) : 1.0f;
+
+    static const int VoltageDAC[2] = { 1, 3 };  // B, D
+    static const int Channels[2][2] = { { ACQ_I1, ACQ_V1 }, { ACQ_I2, ACQ_V2 } };
+
+    for(int i = 0; i < 2; i++)
+    {
+        // Without enable the supply is off and the output discharges through the load
+        float target = en->read(i + 1) ? refToVolts(dac->get(VoltageDAC[i])) : 0.0f;
+        if(target < 0.0f) target = 0.0f;
+        vout[i] += alpha * (target - vout[i]);
+
+        float r = load[i];
+        float ua = (r > 0.0f) ? vout[i] / r : 0.0f;
+
+        last[Channels[i][0]] = toCounts(currentToImon(ua));
+        last[Channels[i][1]] = toCounts(voltsToVmon(vout[i]));
+        filter[Channels[i][0]].process(last[Channels[i][0]]);
+        filter[Channels[i][1]].process(last[Channels[i][1]]);
+    }
+
+    if(on_sample) on_sample();
+}
+
+SimSerial::SimSerial(int out_fd) : out_fd(out_fd)
+{
+
+}
+
+bool SimSerial::readable()
+{
+    std::lock_guard<std::mutex> lock(m);
+    return !rx.empty();
+}
+
+uint8_t SimSerial::getc()
+{
+    std::lock_guard<std::mutex> lock(m);
+    if(rx.empty())
+        return 0;
+
+    uint8_t c = rx.front();
+    rx.pop_front();
+    return c;
+}
+
+int SimSerial::write(const uint8_t* data, int len)
+{
+    if(out_fd >= 0)
+    {
+        ssize_t n = ::write(out_fd, data, len);
+        return n < 0 ? 0 : (int)n;
+    }
+
+    std::lock_guard<std::mutex> lock(m);
+    tx.append((const char*)data, len);
+    return len;
+}
+
+void SimSerial::attach(Callback<void()> on_rx)
+{
+    this->on_rx = on_rx;
+}
+
+void SimSerial::push(const void* data, int len)
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        const uint8_t* p = (const uint8_t*)data;
+        rx.insert(rx.end(), p, p + len);
+    }
+    if(on_rx) on_rx();
+}
+
+std::string SimSerial::take()
+{
+    std::lock_guard<std::mutex> lock(m);
+    std::string out;
+    out.swap(tx);
+    return out;
+}
+
+SimPtySerial::SimPtySerial() : master(-1), len(0), pos(0), total(0)
+{
+    name[0] = '\0';
+}
+
+SimPtySerial::~SimPtySerial()
+{
+    if(master >= 0) close(master);
+}
+
+bool SimPtySerial::open()
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if(master < 0 || grantpt(master) || unlockpt(master))
+        return false;
+
+    // Raw mode, the line discipline must not touch the '\r' terminators or the binary frames
+    const char* slave = ptsname(master);
+    if(!slave)
+        return false;
+
+    snprintf(name, sizeof(name), "%s", slave);
+
+    struct termios t;
+    if(tcgetattr(master, &t) == 0)
+    {
+        cfmakeraw(&t);
+        tcsetattr(master, TCSANOW, &t);
+    }
+
+    // Like the USB port, never block the controller
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+bool SimPtySerial::readable()
+{
+    if(pos < len)
+        return true;
+
+    ssize_t n = read(master, buffer, sizeof(buffer));
+    if(n <= 0)
+        return false;
+
+    len = n;
+    pos = 0;
+    return true;
+}
+
+uint8_t SimPtySerial::getc()
+{
+    if(!readable())
+        return 0;
+
+    total++;
+    return buffer[pos++];
+}
+
+int SimPtySerial::write(const uint8_t* data, int len)
+{
+    ssize_t n = ::write(master, data, len);
+    return n < 0 ? 0 : (int)n;
+}
+
+void SimPtySerial::attach(Callback<void()> on_rx)
+{
+    int fd = master;
+    std::thread([fd, on_rx]()
+    {
+        struct pollfd p = { fd, POLLIN, 0 };
+        while(true)
+        {
+            if(poll(&p, 1, -1) > 0 && (p.revents & POLLIN))
+            {
+                on_rx();
+
+                // The data stays readable until the controller takes it, don't spin on it
+                std::this_thread::sleep_for(50us);
+            }
+        }
+    }).detach();
+}
+
+SimLcd::SimLcd(FILE* log) : log(log), terminators(0), total(0)
+{
+
+}
+
+int SimLcd::write(const uint8_t* data, int len)
+{
+    std::lock_guard<std::mutex> lock(m);
+
+    for(int i = 0; i < len; i++)
+    {
+        if(data[i] != 0xFF)
+        {
+            // A partial terminator is part of the data
+            pending.append(terminators, (char)0xFF);
+            terminators = 0;
+            pending += (char)data[i];
+            continue;
+        }
+
+        if(++terminators < 3)
+            continue;
+
+        terminators = 0;
+        history.push_back(pending);
+        total++;
+        if(history.size() > SIM_LCD_HISTORY) history.erase(history.begin());
+
+        size_t eq = pending.find('=');
+        if(eq != std::string::npos) values[pending.substr(0, eq)] = strtol(pending.c_str() + eq + 1, nullptr, 10);
+        if(log) fprintf(log, "[lcd] %s\n", pending.c_str());
+        pending.clear();
+    }
+    return len;
+}
+
+std::vector<std::string> SimLcd::commands()
+{
+    std::lock_guard<std::mutex> lock(m);
+    return history;
+}
+
+uint32_t SimLcd::count()
+{
+    std::lock_guard<std::mutex> lock(m);
+    return total;
+}
+
+bool SimLcd::value(const std::string& widget, long& v)
+{
+    std::lock_guard<std::mutex> lock(m);
+    auto it = values.find(widget);
+    if(it == values.end())
+        return false;
+
+    v = it->second;
+    return true;
+}
+
+SimStorage::SimStorage(const char* dir) : dir(dir ? dir : "")
+{
+
+}
+
+std::string SimStorage::path(const char* key) const
+{
+    // "/kv/name" -> "<dir>/_kv_name"
+    std::string name(key);
+    for(char& c : name)
+    {
+        if(c == '/') c = '_';
+    }
+    return dir + "/" + name;
+}
+
+bool SimStorage::load(const char* key, void* data, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(m);
+
+    auto it = values.find(key);
+    if(it == values.end() && !dir.empty())
+    {
+        FILE* f = fopen(path(key).c_str(), "rb");
+        if(f)
+        {
+            std::string value;
+            char buffer[256];
+            size_t n;
+            while((n = fread(buffer, 1, sizeof(buffer), f)) > 0) value.append(buffer, n);
+            fclose(f);
+            it = values.emplace(key, value).first;
+        }
+    }
+
+    if(it == values.end() || it->second.size() != size)
+        return false;
+
+    memcpy(data, it->second.data(), size);
+    return true;
+}
+
+bool SimStorage::store(const char* key, const void* data, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(m);
+    values[key] = std::string((const char*)data, size);
+
+    if(dir.empty())
+        return true;
+
+    FILE* f = fopen(path(key).c_str(), "wb");
+    if(!f)
+        return false;
+
+    bool ok = fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+SimLed::SimLed(FILE* log) : log(log)
+{
+    rgb[0] = rgb[1] = rgb[2] = 0.0f;
+}
+
+void SimLed::write(float red, float green, float blue)
+{
+    rgb[0] = red;
+    rgb[1] = green;
+    rgb[2] = blue;
+    if(log) fprintf(log, "[led] %.1f %.1f %.1f\n", red, green, blue);
+}
@@ -0,0 +1,215 @@
+#pragma once
+#include "../HAL.h"
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// Simulated board for the host build.
+// The HV sources are modelled as a first order response to the DAC voltage reference (time constant tau)
+// into a resistive load, the monitors add gaussian noise in ADC counts. The model uses the inverse of the
+// conversions in Controller.cpp, so a correct setpoint reads back as the same value on the monitors.
+
+#define SIM_DEFAULT_TAU_MS 50.0f  // HV output time constant
+#define SIM_DEFAULT_NOISE 8.0f    // Monitor noise, standard deviation [ADC counts]
+#define SIM_DEFAULT_LOAD 20.0f    // Load on each source [MOhm]
+#define SIM_LCD_HISTORY 1024      // LCD commands kept by SimLcd
+
+class SimDac : public DacHal
+{
+public:
+    SimDac();
+
+    void init() override;
+    void write(int channel, float ref) override;
+    void writeBatch(const float* ref, uint8_t mask) override;
+    void writeCodes(const uint16_t* code, uint8_t mask) override;
+
+    // Last value written to channel [mV]
+    float get(int channel) const;
+    uint32_t writes() const { return count; }
+
+    // Writes that changed channel since clearChanges(), with the time of the first and the last one [us_ticker_read()].
+    // The times are taken by the write itself, so a ramp can be timed without polling the DAC.
+    uint32_t changes(int channel) const { return change_count[channel]; }
+    uint32_t firstChange(int channel) const { return first_change[channel]; }
+    uint32_t lastChange(int channel) const { return last_change[channel]; }
+    void clearChanges();
+
+private:
+    void set(int channel, float value, uint32_t t_us);
+
+private:
+    std::atomic<float> ref[DAC_NUM_CHANNELS];
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> change_count[DAC_NUM_CHANNELS];
+    std::atomic<uint32_t> first_change[DAC_NUM_CHANNELS];
+    std::atomic<uint32_t> last_change[DAC_NUM_CHANNELS];
+};
+
+class SimEnable : public EnableHal
+{
+public:
+    SimEnable();
+
+    void write(int source, int value) override;
+    int read(int source) override;
+
+private:
+    std::atomic<int> en[2];
+};
+
+class SimAdc : public AdcHal
+{
+public:
+    SimAdc(SimDac* dac, SimEnable* en);
+
+    void start() override;
+    float read(int ch) const override;
+    uint16_t filtered(int ch) const override;
+    uint16_t raw(int ch) const override;
+    uint32_t sampleTime() const override;
+    void attach(Callback<void()> cb) override;
+    bool setFilter(int ch, FilterType type, float param) override;
+    const Filter& getFilter(int ch) const override;
+
+    // Model parameters, can be changed while running
+    void setTau(float ms);
+    void setNoise(float counts);
+    void setLoad(int source, float mohm);
+
+    // Model output voltage of source [V]
+    float output(int source) const;
+
+private:
+    void sample();
+    uint16_t toCounts(float v);
+
+private:
+    SimDac* dac;
+    SimEnable* en;
+
+    Filter filter[ACQ_NUM_CHANNELS];
+    volatile uint16_t last[ACQ_NUM_CHANNELS];
+    float vout[2];
+
+    std::atomic<float> tau_ms;
+    std::atomic<float> noise;
+    std::atomic<float> load[2];
+    std::mt19937 rng;
+
+    volatile uint32_t t_sample;
+    Callback<void()> on_sample;
+    Ticker ticker;
+};
+
+// In memory serial port, the test/benchmark side pushes the input and collects the output
+// If out_fd is set the output is written there instead (stdout, pty)
+class SimSerial : public SerialHal
+{
+public:
+    SimSerial(int out_fd = -1);
+
+    bool readable() override;
+    uint8_t getc() override;
+    int write(const uint8_t* data, int len) override;
+    void attach(Callback<void()> on_rx) override;
+
+    void push(const void* data, int len);
+    std::string take();
+
+private:
+    int out_fd;
+    Callback<void()> on_rx;
+    std::mutex m;
+    std::deque<uint8_t> rx;
+    std::string tx;
+};
+
+// Device end of a pseudo-terminal, a stand-in for the USB CDC port
+// Host tools (or the benchmark) open slaveName() like they would open the board serial port
+class SimPtySerial : public SerialHal
+{
+public:
+    SimPtySerial();
+    ~SimPtySerial();
+
+    // Creates the pty pair, false on failure
+    bool open();
+    const char* slaveName() const { return name; }
+
+    bool readable() override;
+    uint8_t getc() override;
+    int write(const uint8_t* data, int len) override;
+
+    // Watches the pty on its own thread and calls on_rx while there is unread data
+    void attach(Callback<void()> on_rx) override;
+
+    // Bytes handed to the controller so far
+    uint64_t consumed() const { return total; }
+
+private:
+    int master;
+    char name[64];
+    uint8_t buffer[256];
+    int len;
+    int pos;
+    std::atomic<uint64_t> total;
+};
+
+// Records the Nextion commands sent to the LCD (split on the 0xFF 0xFF 0xFF terminator)
+class SimLcd : public LcdHal
+{
+public:
+    SimLcd(FILE* log = nullptr);
+
+    int write(const uint8_t* data, int len) override;
+
+    // Last SIM_LCD_HISTORY commands and the total count
+    std::vector<std::string> commands();
+    uint32_t count();
+
+    // Last value assigned to a widget (eg. "page0.v1r.val"), false if it was never set
+    bool value(const std::string& widget, long& v);
+
+private:
+    FILE* log;
+    std::mutex m;
+    std::string pending;
+    int terminators;
+    std::vector<std::string> history;
+    uint32_t total;
+    std::map<std::string, long> values;
+};
+
+// Key/value storage kept in memory, and in one file per key under dir if given (persists across runs)
+class SimStorage : public StorageHal
+{
+public:
+    SimStorage(const char* dir = nullptr);
+
+    bool load(const char* key, void* data, uint32_t size) override;
+    bool store(const char* key, const void* data, uint32_t size) override;
+
+private:
+    std::string path(const char* key) const;
+
+private:
+    std::string dir;
+    std::mutex m;
+    std::map<std::string, std::string> values;
+};
+
+class SimLed : public LedHal
+{
+public:
+    SimLed(FILE* log = nullptr);
+
+    void write(float red, float green, float blue) override;
+
+    float rgb[3];
+
+private:
+    FILE* log;
+};
@@ -0,0 +1,340 @@
+#include "SimHardware.h"
+#include "../Controller.h"
+#include "../../Common/SimHarness.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Serial command benchmark, runs the controller on the simulated board with a pseudo-terminal as the USB port.
+// A client thread replays a command mix through the pty, the commands go through serialCB() and dispatch() like on the board.
+//
+// Latency  : one command in flight, time from the write to the end of the comms thread pass that handled it.
+// Throughput : up to --window commands in flight, commands handled per second.
+//
+// Results are written as JSON (stdout or --out). With --max-p99 the exit code is 2 if any command p99 is above it.
+//
+// Usage : hvsource_bench [--mix queries|sets|mixed|batch|FILE] [--count N] [--window N] [--seed N] [--out FILE] [--max-p99 us]
+//
+// Mix files have one "<weight> <command>" per line, {lo:hi} is replaced by a random integer in [lo, hi], # starts a comment.
+
+struct MixEntry
+{
+    int weight;
+    std::string command;
+};
+
+static const char* BuiltinMixes[][2] = {
+    { "queries", "1 1PO?\n1 2PO?\n1 1SV?\n1 2SV?\n1 1SI?\n1 2SI?\n1 1EE?\n" },
+    { "sets",    "1 1PO{0:1}\n1 2PO{0:1}\n1 1SV{0:2000}\n1 2SV{0:2000}\n1 1SI{300:400}\n1 2SI{300:400}\n" },
+    { "mixed",   "1 1PO{0:1}\n1 1PO?\n2 1SV{0:2000}\n2 1SV?\n1 1SI{300:400}\n1 1SI?\n1 1EE?\n" },
+    { "batch",   "1 1SV?;1SI?;2SV?;2SI?\n1 0RA?\n1 1SV{0:2000};2SV{0:2000}\n" }
+};
+
+// Both limits well above what the simulated load draws at full scale, so nothing trips while benchmarking
+static const char* Preamble[] = { "1SI400", "2SI400" };
+
+static int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool parseMix(std::istream& in, std::vector<MixEntry>& mix)
+{
+    std::string line;
+    while(std::getline(in, line))
+    {
+        size_t c = line.find('#');
+        if(c != std::string::npos) line.erase(c);
+
+        std::istringstream ss(line);
+        MixEntry e;
+        if(!(ss >> e.weight))
+            continue;
+        if(!(ss >> e.command) || e.weight <= 0)
+            return false;
+        mix.push_back(e);
+    }
+    return !mix.empty();
+}
+
+static std::string expand(const std::string& command, std::mt19937& rng)
+{
+    std::string out;
+    for(size_t i = 0; i < command.size(); i++)
+    {
+        int lo, hi, n;
+        if(command[i] == '{' && sscanf(command.c_str() + i, "{%d:%d}%n", &lo, &hi, &n) == 2)
+        {
+            out += std::to_string(std::uniform_int_distribution<int>(lo, hi)(rng));
+            i += n - 1;
+        }
+        else
+        {
+            out += command[i];
+        }
+    }
+    return out;
+}
+
+// Statistics key : command code and set/query (eg. SV_set, SV_query), batch for multiple commands
+static std::string keyOf(const std::string& command)
+{
+    if(command.find(';') != std::string::npos) return "batch";
+    if(command.size() < 4) return "malformed";
+    return command.substr(1, 2) + (command[3] == '?' ? "_query" : "_set");
+}
+
+static std::vector<std::string> script(const std::vector<MixEntry>& mix, int count, std::mt19937& rng)
+{
+    std::vector<int> weights;
+    for(const MixEntry& e : mix) weights.push_back(e.weight);
+    std::discrete_distribution<int> pick(weights.begin(), weights.end());
+
+    std::vector<std::string> out;
+    for(int i = 0; i < count; i++)
+    {
+        out.push_back(expand(mix[pick(rng)].command, rng));
+    }
+    return out;
+}
+
+struct Percentiles
+{
+    size_t count;
+    double mean, p50, p90, p99, max;
+};
+
+static Percentiles percentiles(std::vector<double> v)
+{
+    Percentiles p = { v.size(), 0, 0, 0, 0, 0 };
+    if(v.empty())
+        return p;
+
+    std::sort(v.begin(), v.end());
+    auto rank = [&](double q) { return v[std::min(v.size() - 1, (size_t)std::ceil(q * v.size()) - 1)]; };
+
+    for(double x : v) p.mean += x;
+    p.mean /= v.size();
+    p.p50 = rank(0.50);
+    p.p90 = rank(0.90);
+    p.p99 = rank(0.99);
+    p.max = v.back();
+    return p;
+}
+
+// Set by the controller comms thread after every pass
+static std::atomic<uint64_t> done_bytes(0);
+static std::atomic<int64_t> done_ns(0);
+
+class Client
+{
+public:
+    Client(int fd) : fd(fd), sent(0) {  }
+
+    // Sends the command, returns the byte offset the controller must reach to have handled it
+    uint64_t send(const std::string& command)
+    {
+        std::string line = command + "\r";
+        const char* p = line.c_str();
+        size_t left = line.size();
+        while(left)
+        {
+            ssize_t n = write(fd, p, left);
+            if(n <= 0) continue;
+            p += n;
+            left -= n;
+        }
+        sent += line.size();
+        return sent;
+    }
+
+    static void waitFor(uint64_t offset)
+    {
+        while(done_bytes.load() < offset) std::this_thread::yield();
+    }
+
+private:
+    int fd;
+    uint64_t sent;
+};
+
+int main(int argc, char** argv)
+{
+    const char* mix_arg = "mixed";
+    int count = 2000;
+    int window = 8;
+    unsigned seed = 1;
+    const char* out_path = nullptr;
+    double max_p99 = 0.0;
+
+    const SimOption Options[] = {
+        { "--mix",     SIM_OPT_TEXT,   &mix_arg,  "queries|sets|mixed|batch|FILE" },
+        { "--count",   SIM_OPT_INT,    &count,    "N" },
+        { "--window",  SIM_OPT_INT,    &window,   "N" },
+        { "--seed",    SIM_OPT_UINT,   &seed,     "N" },
+        { "--out",     SIM_OPT_TEXT,   &out_path, "FILE" },
+        { "--max-p99", SIM_OPT_DOUBLE, &max_p99,  "us" }
+    };
+    if(!simParseArgs(argc, argv, Options))
+        return SIM_EXIT_USAGE;
+    std::string mix_name = mix_arg;
+
+    if(count <= 0 || window <= 0)
+    {
+        fprintf(stderr, "--count and --window must be positive\n");
+        return SIM_EXIT_USAGE;
+    }
+
+    std::vector<MixEntry> mix;
+    bool builtin = false;
+    for(auto& m : BuiltinMixes)
+    {
+        if(mix_name != m[0]) continue;
+        std::istringstream in(m[1]);
+        parseMix(in, mix);
+        builtin = true;
+    }
+    if(!builtin)
+    {
+        std::ifstream in(mix_name);
+        if(!in || !parseMix(in, mix))
+        {
+            fprintf(stderr, "Mix %s not found or invalid\n", mix_name.c_str());
+            return SIM_EXIT_USAGE;
+        }
+    }
+
+    static SimDac dac;
+    static SimEnable en;
+    static SimAdc adc(&dac, &en);
+    static SimPtySerial serial;
+    static SimLcd lcd;
+    static SimLed led;
+    static SimStorage storage;
+
+    if(!serial.open())
+    {
+        perror("pty");
+        return 1;
+    }
+
+    int fd = open(serial.slaveName(), O_RDWR | O_NOCTTY);
+    if(fd < 0)
+    {
+        perror(serial.slaveName());
+        return 1;
+    }
+
+    HVHardware hw;
+    hw.dac = &dac;
+    hw.adc = &adc;
+    hw.en = &en;
+    hw.serial = &serial;
+    hw.lcd = &lcd;
+    hw.led = &led;
+    hw.storage = &storage;
+
+    // Set by the comms thread after every pass
+    controllerAttachCommsPass([]()
+    {
+        uint64_t c = serial.consumed();
+        if(c != done_bytes.load())
+        {
+            done_ns = nowNs();
+            done_bytes = c;
+        }
+    });
+    controllerInit(hw);
+
+    // Replies are only counted, the pty must be kept drained or the controller would wait for room
+    static std::atomic<uint64_t> reply_bytes(0);
+    std::thread([fd]()
+    {
+        char data[1024];
+        ssize_t n;
+        while((n = read(fd, data, sizeof(data))) > 0) reply_bytes += n;
+    }).detach();
+
+    std::mt19937 rng(seed);
+    std::vector<std::string> latency_script = script(mix, count, rng);
+    std::vector<std::string> throughput_script = script(mix, count, rng);
+
+    std::map<std::string, std::vector<double>> latency;
+    std::vector<double> all;
+    double seconds = 0.0;
+    uint64_t throughput_bytes = 0;
+
+    std::thread client([&]()
+    {
+        Client c(fd);
+        for(const char* p : Preamble) Client::waitFor(c.send(p));
+
+        for(const std::string& command : latency_script)
+        {
+            int64_t t0 = nowNs();
+            Client::waitFor(c.send(command));
+            double us = (done_ns.load() - t0) / 1000.0;
+            latency[keyOf(command)].push_back(us);
+            all.push_back(us);
+        }
+
+        std::vector<uint64_t> ends;
+        uint64_t bytes0 = reply_bytes;
+        int64_t t0 = nowNs();
+        size_t acked = 0;
+        for(const std::string& command : throughput_script)
+        {
+            ends.push_back(c.send(command));
+            while(ends.size() - acked >= (size_t)window)
+            {
+                Client::waitFor(ends[acked]);
+                acked++;
+            }
+        }
+        Client::waitFor(ends.back());
+        seconds = (done_ns.load() - t0) / 1e9;
+        throughput_bytes = reply_bytes - bytes0;
+
+    });
+
+    client.join();
+
+    FILE* out = simOpenOutput(out_path);
+    if(!out)
+        return SIM_EXIT_USAGE;
+
+    bool failed = false;
+    auto print = [&](const Percentiles& p)
+    {
+        fprintf(out, "{ \"count\": %zu, \"mean_us\": %.2f, \"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f }",
+                p.count, p.mean, p.p50, p.p90, p.p99, p.max);
+    };
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"benchmark\": \"hvsource_commands\",\n");
+    fprintf(out, "  \"link\": \"pty\",\n");
+    fprintf(out, "  \"mix\": \"%s\",\n", mix_name.c_str());
+    fprintf(out, "  \"seed\": %u,\n", seed);
+    fprintf(out, "  \"latency\": {\n");
+    fprintf(out, "    \"all\": ");
+    print(percentiles(all));
+    for(auto& l : latency)
+    {
+        Percentiles p = percentiles(l.second);
+        if(max_p99 > 0.0 && p.p99 > max_p99) failed = true;
+
+        fprintf(out, ",\n    \"%s\": ", l.first.c_str());
+        print(p);
+    }
+    fprintf(out, "\n  },\n");
+    fprintf(out, "  \"throughput\": { \"commands\": %d, \"window\": %d, \"seconds\": %.4f, \"commands_per_s\": %.1f, \"reply_bytes\": %llu }\n",
+            count, window, seconds, seconds > 0.0 ? count / seconds : 0.0, (unsigned long long)throughput_bytes);
+    fprintf(out, "}\n");
+    int result = simFinish(out, failed, "p99 latency above %.2f us", max_p99);
+
+    // The firmware threads never return, skip the static destructors they are still waiting on
+    _exit(result);
+}
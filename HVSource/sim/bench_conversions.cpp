@@ -0,0 +1,195 @@
+#include "../HAL.h"
+#include "../Calibration.h"
+#include "../../Common/SimHarness.h"
+#include <cmath>
+#include <random>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Float vs fixed point (HV_FIXED_POINT) conversion paths, on the calibration tables of Calibration.h.
+// Both paths are always built here, whatever the HV_FIXED_POINT setting of the firmware.
+//
+// Equivalence : every ADC count (monitors) or every setpoint in the range (set tables) goes through both paths,
+//               the largest difference must stay within one output unit (mV, nA or DAC code).
+// Speed       : time per conversion over random inputs, in TSC cycles on x86 (nanoseconds elsewhere).
+//               The host FPU is much faster than the F446 one, the target speedup is larger than the one reported here.
+//
+// Checked on the factory tables and on a 12 point table with a curved response (every segment is used).
+// Results are written as JSON (stdout or --out), the exit code is 2 if a difference is above the tolerance.
+//
+// Usage : hvsource_bench_conv [--iterations N] [--out FILE]
+
+#define BENCH_INPUTS 4096
+#define BENCH_TOLERANCE 1.0
+
+static const char* TableNames[CAL_NUM_TABLES] = { "V_SET", "V_MON", "I_SET", "I_MON" };
+
+// Input range of each table, in fixed point units : setpoints [mV] / [nA], monitors [ADC counts]
+static const int32_t InputRange[CAL_NUM_TABLES] = { 2400000, ADC_FULL_SCALE, 500000, ADC_FULL_SCALE };
+
+static volatile int32_t sink;
+
+static uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static bool isSetTable(int id)
+{
+    return id == CAL_V_SET || id == CAL_I_SET;
+}
+
+// Float path of Controller.cpp, without the final rounding to compare the exact value
+static double floatPath(const CalTable& table, int id, int32_t x)
+{
+    if(isSetTable(id))
+        return table.apply(x * 0.001f) * ((float)DAC_RESOLUTION / DAC_VREF_MV);
+    return table.apply(x * (ADC_VREF / ADC_FULL_SCALE)) * 1000.0f;
+}
+
+static int32_t floatConvert(const CalTable& table, int id, int32_t x)
+{
+    if(isSetTable(id))
+        return DacHal::toCode(table.apply(x * 0.001f));
+    return lroundf(table.apply(x * (ADC_VREF / ADC_FULL_SCALE)) * 1000.0f);
+}
+
+static int32_t fixedConvert(const CalTableQ& table, int id, int32_t x)
+{
+    if(isSetTable(id))
+        return DacHal::clampCode(table.apply(x));
+    return table.apply(x);
+}
+
+// Monotonic, slightly curved version of the factory table (12 points over the input range)
+static void curvedTable(Calibration& cal, int id)
+{
+    const CalTable& base = cal.table(1, (CalTableId)id);
+    float x0 = base.x(0);
+    float x1 = base.x(base.size() - 1);
+
+    for(int i = 0; i < CAL_MAX_POINTS; i++)
+    {
+        float t = (float)i / (CAL_MAX_POINTS - 1);
+        float x = x0 + (x1 - x0) * t;
+        float y = base.apply(x) * (1.0f + 0.02f * t * t);
+        cal.setPoint(1, (CalTableId)id, i, x, y);
+    }
+    cal.apply(1, (CalTableId)id, CAL_MAX_POINTS);
+}
+
+struct Result
+{
+    double max_error;
+    double float_ticks;
+    double fixed_ticks;
+};
+
+static Result run(const Calibration& cal, int id, int iterations, std::mt19937& rng)
+{
+    const CalTable& table = cal.table(1, (CalTableId)id);
+    const CalTableQ& fixed = cal.fixed(1, (CalTableId)id);
+    Result r = { 0.0, 0.0, 0.0 };
+
+    // Set tables saturate to the DAC range, compare where the float path does not
+    int32_t step = InputRange[id] > 100000 ? 7 : 1;
+    for(int32_t x = 0; x <= InputRange[id]; x += step)
+    {
+        double expected = floatPath(table, id, x);
+        if(isSetTable(id) && (expected < 0.0 || expected > DAC_RESOLUTION - 1))
+            continue;
+
+        double error = std::fabs(fixedConvert(fixed, id, x) - expected);
+        if(error > r.max_error) r.max_error = error;
+    }
+
+    std::vector<int32_t> inputs(BENCH_INPUTS);
+    std::uniform_int_distribution<int32_t> pick(0, InputRange[id]);
+    for(int32_t& x : inputs) x = pick(rng);
+
+    int32_t acc = 0;
+    uint64_t t0 = ticks();
+    for(int n = 0; n < iterations; n++)
+    {
+        for(int32_t x : inputs) acc += floatConvert(table, id, x);
+    }
+    uint64_t t1 = ticks();
+    for(int n = 0; n < iterations; n++)
+    {
+        for(int32_t x : inputs) acc += fixedConvert(fixed, id, x);
+    }
+    uint64_t t2 = ticks();
+    sink = acc;
+
+    double calls = (double)iterations * BENCH_INPUTS;
+    r.float_ticks = (t1 - t0) / calls;
+    r.fixed_ticks = (t2 - t1) / calls;
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 200;
+    const char* out_path = nullptr;
+
+    const SimOption Options[] = {
+        { "--iterations", SIM_OPT_INT,  &iterations, "N" },
+        { "--out",        SIM_OPT_TEXT, &out_path,   "FILE" }
+    };
+    if(!simParseArgs(argc, argv, Options))
+        return SIM_EXIT_USAGE;
+
+    if(iterations <= 0)
+    {
+        fprintf(stderr, "--iterations must be positive\n");
+        return SIM_EXIT_USAGE;
+    }
+
+    static Calibration factory;
+    static Calibration curved;
+    for(int t = 0; t < CAL_NUM_TABLES; t++)
+    {
+        curvedTable(curved, t);
+    }
+
+    FILE* out = simOpenOutput(out_path);
+    if(!out)
+        return SIM_EXIT_USAGE;
+
+    std::mt19937 rng(1);
+    bool failed = false;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"benchmark\": \"hvsource_conversions\",\n");
+#if defined(__x86_64__) || defined(__i386__)
+    fprintf(out, "  \"unit\": \"cycles\",\n");
+#else
+    fprintf(out, "  \"unit\": \"ns\",\n");
+#endif
+    fprintf(out, "  \"tolerance\": %.1f,\n", BENCH_TOLERANCE);
+
+    const struct { const char* name; const Calibration* cal; } Sets[] = { { "factory", &factory }, { "curved", &curved } };
+    for(size_t s = 0; s < sizeof(Sets) / sizeof(Sets[0]); s++)
+    {
+        fprintf(out, "  \"%s\": {\n", Sets[s].name);
+        for(int t = 0; t < CAL_NUM_TABLES; t++)
+        {
+            Result r = run(*Sets[s].cal, t, iterations, rng);
+            if(r.max_error > BENCH_TOLERANCE) failed = true;
+
+            fprintf(out, "    \"%s\": { \"max_error\": %.3f, \"float\": %.2f, \"fixed\": %.2f, \"speedup\": %.2f }%s\n",
+                    TableNames[t], r.max_error, r.float_ticks, r.fixed_ticks,
+                    r.fixed_ticks > 0.0 ? r.float_ticks / r.fixed_ticks : 0.0, t < CAL_NUM_TABLES - 1 ? "," : "");
+        }
+        fprintf(out, "  }%s\n", s < sizeof(Sets) / sizeof(Sets[0]) - 1 ? "," : "");
+    }
+    fprintf(out, "}\n");
+
+    return simFinish(out, failed, "Fixed point path differs from the float path by more than %.1f", BENCH_TOLERANCE);
+}
@@ -0,0 +1,149 @@
+#include "SimHardware.h"
+#include "../Controller.h"
+#include <cstdlib>
+#include <unistd.h>
+
+// HVSource running on Linux against the simulated board.
+// Commands are read from stdin and the replies written to stdout, exactly like the USB serial port.
+// Newlines are translated to the '\r' command terminator, unless --raw is given (needed for the binary protocol).
+// The simulator exits once stdin is closed and the pending commands are answered.
+// --storage keeps the calibration (flash on the board) in dir, across runs.
+// With --pty the serial port is a pseudo-terminal instead (its path is printed), so the host software can connect to it.
+//
+// Usage : hvsource_sim [--tau ms] [--noise counts] [--load MOhm1,MOhm2] [--raw] [--pty] [--storage dir] [--verbose]
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "Usage : %s [--tau ms] [--noise counts] [--load MOhm1,MOhm2] [--raw] [--pty] [--storage dir] [--verbose]\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    float tau = SIM_DEFAULT_TAU_MS;
+    float noise = SIM_DEFAULT_NOISE;
+    float load[2] = { SIM_DEFAULT_LOAD, SIM_DEFAULT_LOAD };
+    bool raw = false;
+    bool pty = false;
+    const char* storage_dir = nullptr;
+    bool verbose = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--tau") && i + 1 < argc)
+        {
+            tau = atof(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--noise") && i + 1 < argc)
+        {
+            noise = atof(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "--load") && i + 1 < argc)
+        {
+            if(sscanf(argv[++i], "%f,%f", &load[0], &load[1]) != 2) usage(argv[0]);
+        }
+        else if(!strcmp(argv[i], "--raw"))
+        {
+            raw = true;
+        }
+        else if(!strcmp(argv[i], "--pty"))
+        {
+            pty = true;
+        }
+        else if(!strcmp(argv[i], "--storage") && i + 1 < argc)
+        {
+            storage_dir = argv[++i];
+        }
+        else if(!strcmp(argv[i], "--verbose"))
+        {
+            verbose = true;
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+
+    static SimDac dac;
+    static SimEnable en;
+    static SimAdc adc(&dac, &en);
+    static SimSerial serial(STDOUT_FILENO);
+    static SimPtySerial pty_serial;
+    static SimLcd lcd(verbose ? stderr : nullptr);
+    static SimLed led(verbose ? stderr : nullptr);
+    static SimStorage storage(storage_dir);
+
+    adc.setTau(tau);
+    adc.setNoise(noise);
+    adc.setLoad(1, load[0]);
+    adc.setLoad(2, load[1]);
+
+    HVHardware hw;
+    hw.dac = &dac;
+    hw.adc = &adc;
+    hw.en = &en;
+    hw.serial = &serial;
+    if(pty)
+    {
+        if(!pty_serial.open())
+        {
+            perror("pty");
+            return 1;
+        }
+        fprintf(stderr, "Serial port : %s\n", pty_serial.slaveName());
+        hw.serial = &pty_serial;
+    }
+    hw.lcd = &lcd;
+    hw.led = &led;
+    hw.storage = &storage;
+    controllerInit(hw);
+
+    // The controller runs on its own threads
+    if(pty)
+    {
+        while(true)
+        {
+            std::this_thread::sleep_for(1s);
+        }
+    }
+
+    // stdin -> serial input
+    static std::atomic<bool> input_done(false);
+    std::thread reader([raw]()
+    {
+        uint8_t data[256];
+        ssize_t n;
+        while((n = read(STDIN_FILENO, data, sizeof(data))) > 0)
+        {
+            for(ssize_t i = 0; i < n && !raw; i++)
+            {
+                if(data[i] == '\n') data[i] = '\r';
+            }
+            serial.push(data, n);
+        }
+        input_done = true;
+    });
+
+    // Runs until the input ends and the last replies are out
+    Timer idle;
+    idle.start();
+    while(true)
+    {
+        // Read in this order, once the input is done every byte was already pushed
+        bool done = input_done;
+        bool pending = serial.readable();
+
+        if(pending)
+            idle.reset();
+        else if(done && idle.elapsed_time() > 100ms)
+            break;
+
+        std::this_thread::sleep_for(1ms);
+    }
+
+    reader.join();
+
+    // The firmware threads never return, skip the static destructors they are still waiting on
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,210 @@
+#include "../Filter.h"
+#include "../HAL.h"
+#include "../../Common/SimHarness.h"
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Monitor filters (Filter.h) against the averaging they replaced : a boxcar of the last 100 samples, summed on every read.
+//
+// Step response : samples to reach 90 % of a step, from a steady level. The moving average of 100 samples must match
+//                 the boxcar exactly, the IIR must follow its time constant and the median must only add a few samples.
+// Start         : a new filter (boot) and a reconfigured one (FT/FP) read the signal level from their first output.
+// Spikes        : a single sample spike must not reach the median output.
+// Parameters    : configure() refuses an IIR time constant of 0 or above FILTER_MAX_IIR.
+// Throughput    : time per sample of process() and of the boxcar sum, on random input. Reported only, wall clock
+//                 timings are not a pass/fail criterion on a shared machine.
+// Results are written as JSON, the exit code is 2 if a check fails.
+//
+// Usage : hvsource_test_filter [--iterations N]
+
+#define BOXCAR_LENGTH 100
+#define STEP_LOW 1000
+#define STEP_HIGH 41000
+#define STEP_SAMPLES 400
+#define THROUGHPUT_INPUTS 4096
+#define THROUGHPUT_RUNS 5
+
+// The averaging of the original firmware, recomputed over the whole window on every read
+class Boxcar
+{
+public:
+    Boxcar() : index(0)
+    {
+        for(uint16_t& v : window) v = 0;
+    }
+
+    void seed(uint16_t x)
+    {
+        for(uint16_t& v : window) v = x;
+    }
+
+    uint16_t process(uint16_t x)
+    {
+        window[index] = x;
+        index = (index + 1) % BOXCAR_LENGTH;
+
+        uint32_t sum = 0;
+        for(uint16_t v : window) sum += v;
+        return sum / BOXCAR_LENGTH;
+    }
+
+private:
+    uint16_t window[BOXCAR_LENGTH];
+    int index;
+};
+
+static volatile uint32_t sink;
+
+static double nowNs()
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Samples after the step until the output reaches 90 % of it, -1 if never
+template<typename F>
+static int rise90(F& f, std::vector<uint16_t>* trace = nullptr)
+{
+    for(int i = 0; i < 200; i++) f.process(STEP_LOW);
+
+    const uint16_t threshold = STEP_LOW + (STEP_HIGH - STEP_LOW) * 9 / 10;
+    int reached = -1;
+    for(int i = 0; i < STEP_SAMPLES; i++)
+    {
+        uint16_t y = f.process(STEP_HIGH);
+        if(trace) trace->push_back(y);
+        if(reached < 0 && y >= threshold) reached = i + 1;
+    }
+    return reached;
+}
+
+// Best of a few runs, so a preempted run doesn't fail the comparison
+template<typename F>
+static double nsPerSample(F& f, const std::vector<uint16_t>& inputs, int iterations)
+{
+    double best = 0.0;
+    for(int run = 0; run < THROUGHPUT_RUNS; run++)
+    {
+        uint32_t acc = 0;
+        double t0 = nowNs();
+        for(int n = 0; n < iterations; n++)
+        {
+            for(uint16_t x : inputs) acc += f.process(x);
+        }
+        double t1 = nowNs();
+        sink = acc;
+
+        double ns = (t1 - t0) / ((double)iterations * inputs.size());
+        if(run == 0 || ns < best) best = ns;
+    }
+    return best;
+}
+
+static Filter makeFilter(FilterType type)
+{
+    Filter f;
+    f.configure(type, Filter::defaultParam(type), ACQ_RATE_HZ);
+    return f;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 40;
+    const SimOption Options[] = { { "--iterations", SIM_OPT_INT, &iterations, "N" } };
+    if(!simParseArgs(argc, argv, Options))
+        return SIM_EXIT_USAGE;
+
+    bool failed = false;
+    const FilterType Types[] = { FILTER_AVERAGE, FILTER_IIR, FILTER_MEDIAN };
+    const char* Names[] = { "average", "iir", "median" };
+
+    // Step response
+    Boxcar boxcar;
+    boxcar.seed(STEP_LOW);
+    std::vector<uint16_t> boxcar_trace;
+    int boxcar_rise = rise90(boxcar, &boxcar_trace);
+
+    int rise[3];
+    bool average_matches = true;
+    for(int t = 0; t < 3; t++)
+    {
+        Filter f = makeFilter(Types[t]);
+        std::vector<uint16_t> trace;
+        rise[t] = rise90(f, &trace);
+        if(Types[t] == FILTER_AVERAGE) average_matches = (trace == boxcar_trace);
+    }
+
+    // y[n] = 1 - (1 - alpha)^n, 90 % after ln(10) time constants
+    double tau_samples = FILTER_DEFAULT_IIR * ACQ_RATE_HZ / 1000.0;
+    double iir_expected = std::log(10.0) * tau_samples;
+
+    bool step_ok = average_matches && rise[0] == boxcar_rise &&
+                   std::fabs(rise[1] - iir_expected) <= 2.0 &&
+                   rise[2] >= 1 && rise[2] <= FILTER_DEFAULT_MEDIAN / 2 + 1;
+    if(!step_ok) failed = true;
+
+    // First output of a new filter, and of a filter reconfigured while the signal is steady
+    bool start_ok = true;
+    for(int t = 0; t < 3; t++)
+    {
+        Filter f = makeFilter(Types[t]);
+        if(f.process(STEP_HIGH) != STEP_HIGH) start_ok = false;
+
+        Filter g;
+        g.configure(Types[t], Filter::defaultParam(Types[t]) * (Types[t] == FILTER_MEDIAN ? 1 : 2), ACQ_RATE_HZ);
+        g.seed(f.output());
+        if(g.process(STEP_HIGH) != STEP_HIGH) start_ok = false;
+    }
+    if(!start_ok) failed = true;
+
+    // IIR time constant bounds
+    Filter bounded = makeFilter(FILTER_IIR);
+    bool bounds_ok = !bounded.configure(FILTER_IIR, 0.0f, ACQ_RATE_HZ) && !bounded.configure(FILTER_IIR, FILTER_MAX_IIR * 2, ACQ_RATE_HZ) &&
+                     bounded.configure(FILTER_IIR, FILTER_MAX_IIR, ACQ_RATE_HZ) && bounded.getParam() == FILTER_MAX_IIR;
+    if(!bounds_ok) failed = true;
+
+    // Single sample spike
+    Filter median = makeFilter(FILTER_MEDIAN);
+    for(int i = 0; i < 20; i++) median.process(STEP_LOW);
+    bool spike_ok = median.process(65535) == STEP_LOW && median.process(STEP_LOW) == STEP_LOW;
+    if(!spike_ok) failed = true;
+
+    // Throughput
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pick(0, 65535);
+    std::vector<uint16_t> inputs(THROUGHPUT_INPUTS);
+    for(uint16_t& x : inputs) x = pick(rng);
+
+    double boxcar_ns = nsPerSample(boxcar, inputs, iterations);
+    double ns[3];
+    for(int t = 0; t < 3; t++)
+    {
+        Filter f = makeFilter(Types[t]);
+        ns[t] = nsPerSample(f, inputs, iterations);
+    }
+
+    printf("{\n");
+    printf("  \"test\": \"hvsource_filters\",\n");
+    printf("  \"step\": {\n");
+    printf("    \"boxcar_100\": { \"rise90_samples\": %d },\n", boxcar_rise);
+    printf("    \"average\": { \"rise90_samples\": %d, \"matches_boxcar\": %s },\n", rise[0], average_matches ? "true" : "false");
+    printf("    \"iir\": { \"rise90_samples\": %d, \"expected\": %.1f },\n", rise[1], iir_expected);
+    printf("    \"median\": { \"rise90_samples\": %d },\n", rise[2]);
+    printf("    \"pass\": %s\n", step_ok ? "true" : "false");
+    printf("  },\n");
+    printf("  \"start_from_signal\": %s,\n", start_ok ? "true" : "false");
+    printf("  \"median_rejects_spike\": %s,\n", spike_ok ? "true" : "false");
+    printf("  \"rejects_bad_params\": %s,\n", bounds_ok ? "true" : "false");
+    printf("  \"throughput_ns_per_sample\": {\n");
+    printf("    \"boxcar_100\": %.2f,\n", boxcar_ns);
+    for(int t = 0; t < 3; t++)
+    {
+        printf("    \"%s\": %.2f,\n", Names[t], ns[t]);
+    }
+    printf("    \"average_speedup\": %.1f\n", ns[0] > 0.0 ? boxcar_ns / ns[0] : 0.0);
+    printf("  },\n");
+    printf("  \"pass\": %s\n}\n", failed ? "false" : "true");
+
+    return simFinish(stdout, failed, "Filter check failed");
+}
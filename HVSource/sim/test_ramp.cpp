@@ -0,0 +1,203 @@
+#include "RampEngine.h"
+#include "../../Common/SimHarness.h"
+#include <cmath>
+#include <random>
+
+// Ramp levels against a simulated clock. RampEngine only knows the times passed to start() and update(),
+// so every level can be checked against the elapsed time, whatever the tick period.
+//
+// Each case ticks the engine on its own schedule (the 4 kHz firmware period or a random one) and compares
+// every level with start + slew * elapsed, clamped at the target, within float rounding. A ramp must reach
+// its target on the first tick at or after start + |target - start| / slew, never before.
+// Results are written as JSON, the exit code is 2 if a case fails.
+//
+// Usage : hvsource_test_ramp [--seed N]
+
+#define TEST_TICK_US 250            // Firmware ramp period
+#define TEST_MAX_JITTER_US 2000     // Random schedule : 1 us to this between ticks
+#define TEST_TOLERANCE_V 1e-3       // Float rounding at 2400 V is about 0.2 mV
+#define TEST_MAX_ACTIONS 4
+
+enum ActionType
+{
+    ACT_START,  // Ramp to value [V]
+    ACT_SLEW    // Change the slew rate to value [V/s]
+};
+
+struct Action
+{
+    uint64_t t_us;
+    int source;
+    ActionType type;
+    float value;
+};
+
+struct RampCase
+{
+    const char* name;
+    float level[RAMP_NUM_SOURCES];  // Before the first action [V]
+    float slew[RAMP_NUM_SOURCES];   // [V/s]
+    Action actions[TEST_MAX_ACTIONS];
+    int num_actions;
+    bool jitter;
+    uint64_t duration_us;
+};
+
+static const RampCase Cases[] = {
+    { "both_sources", { 0.0f, 0.0f }, { 1000.0f, 4000.0f },
+      { { 1000, 1, ACT_START, 1000.0f }, { 1000, 2, ACT_START, 2000.0f } }, 2, false, 1200000 },
+    { "falling", { 2000.0f, 0.0f }, { 500.0f, 500.0f },
+      { { 1000, 1, ACT_START, 500.0f } }, 1, false, 3200000 },
+    { "jitter", { 0.0f, 0.0f }, { 1000.0f, 4000.0f },
+      { { 1000, 1, ACT_START, 1000.0f }, { 1000, 2, ACT_START, 2000.0f } }, 2, true, 1200000 },
+    { "slew_change", { 0.0f, 0.0f }, { 1000.0f, 1000.0f },
+      { { 0, 1, ACT_START, 1000.0f }, { 250100, 1, ACT_SLEW, 2000.0f } }, 2, false, 800000 },
+    { "retarget", { 0.0f, 0.0f }, { 1000.0f, 1000.0f },
+      { { 0, 1, ACT_START, 1000.0f }, { 500100, 1, ACT_START, 200.0f } }, 2, true, 1000000 },
+};
+#define NUM_CASES (int)(sizeof(Cases) / sizeof(Cases[0]))
+
+// Expected level of one source, anchored like RampEngine : a start or a slew change continues
+// from the level of the last tick
+struct Reference
+{
+    double start;
+    double target;
+    double slew;
+    uint64_t t_start;
+
+    double level(uint64_t t_us) const
+    {
+        double dv = slew * (double)(t_us - t_start) * 1e-6;
+        if(target > start) return fmin(start + dv, target);
+        return fmax(start - dv, target);
+    }
+
+    // Time the target is reached [us]
+    double end() const
+    {
+        return t_start + fabs(target - start) / slew * 1e6;
+    }
+};
+
+struct SourceResult
+{
+    bool ramped;
+    double expected_us;     // From the last action on the source
+    uint64_t reached_us;    // First tick at the target, 0 if never
+    double max_error;       // [V]
+    bool pass;
+};
+
+static bool runCase(const RampCase& c, std::mt19937& rng, SourceResult* result, uint32_t& ticks)
+{
+    std::uniform_int_distribution<int> period(1, TEST_MAX_JITTER_US);
+
+    RampEngine ramp(c.slew[0]);
+    Reference ref[RAMP_NUM_SOURCES];
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        ramp.setSlew(i + 1, c.slew[i]);
+        ramp.reset(i + 1, c.level[i]);
+        ref[i] = Reference{ c.level[i], c.level[i], c.slew[i], 0 };
+        result[i] = SourceResult{ false, 0.0, 0, 0.0, true };
+    }
+
+    uint64_t last_tick = 0;
+    uint64_t max_step = 0;
+    int next_action = 0;
+    ticks = 0;
+
+    for(uint64_t t = 0; t <= c.duration_us; )
+    {
+        // Actions due before this tick happen at their own time, like a command between two ticks
+        while(next_action < c.num_actions && c.actions[next_action].t_us <= t)
+        {
+            const Action& a = c.actions[next_action++];
+            Reference& r = ref[a.source - 1];
+            r.start = r.level(last_tick);
+            if(a.type == ACT_START)
+            {
+                ramp.start(a.source, a.value, a.t_us);
+                r.target = a.value;
+                r.t_start = a.t_us;
+            }
+            else
+            {
+                ramp.setSlew(a.source, a.value);
+                r.slew = a.value;
+                r.t_start = last_tick;
+            }
+            result[a.source - 1].ramped = true;
+            result[a.source - 1].reached_us = 0;
+        }
+
+        ramp.update(t);
+        ticks++;
+
+        for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+        {
+            SourceResult& s = result[i];
+            double error = fabs(ramp.getLevel(i + 1) - ref[i].level(t));
+            if(error > s.max_error) s.max_error = error;
+            if(s.ramped && !s.reached_us && ramp.getLevel(i + 1) == (float)ref[i].target) s.reached_us = t;
+        }
+
+        uint64_t step = c.jitter ? period(rng) : TEST_TICK_US;
+        if(step > max_step) max_step = step;
+        last_tick = t;
+        t += step;
+    }
+
+    bool pass = true;
+    for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+    {
+        SourceResult& s = result[i];
+        s.expected_us = ref[i].end();
+        s.pass = s.max_error <= TEST_TOLERANCE_V;
+        if(s.ramped)
+        {
+            // Reached on the first tick at or after the end (1 us for float rounding), and stopped there
+            s.pass = s.pass && s.reached_us && s.reached_us + 1 >= s.expected_us &&
+                     s.reached_us <= s.expected_us + max_step && !ramp.isActive(i + 1);
+        }
+        pass = pass && s.pass;
+    }
+    return pass;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned seed = 1;
+    const SimOption Options[] = { { "--seed", SIM_OPT_UINT, &seed, "N" } };
+    if(!simParseArgs(argc, argv, Options))
+        return SIM_EXIT_USAGE;
+
+    std::mt19937 rng(seed);
+    bool failed = false;
+
+    printf("{\n");
+    printf("  \"test\": \"hvsource_ramp\",\n");
+    printf("  \"seed\": %u,\n", seed);
+    printf("  \"tolerance_v\": %.4f,\n", TEST_TOLERANCE_V);
+    printf("  \"cases\": [\n");
+    for(int n = 0; n < NUM_CASES; n++)
+    {
+        SourceResult result[RAMP_NUM_SOURCES];
+        uint32_t ticks;
+        if(!runCase(Cases[n], rng, result, ticks)) failed = true;
+
+        for(int i = 0; i < RAMP_NUM_SOURCES; i++)
+        {
+            const SourceResult& s = result[i];
+            bool last = (n == NUM_CASES - 1) && (i == RAMP_NUM_SOURCES - 1);
+            printf("    { \"case\": \"%s\", \"source\": %d, \"ticks\": %lu, ", Cases[n].name, i + 1, (unsigned long)ticks);
+            if(s.ramped) printf("\"expected_ms\": %.3f, \"reached_ms\": %.3f, ", s.expected_us * 1e-3, s.reached_us * 1e-3);
+            printf("\"max_error_v\": %.6f, \"pass\": %s }%s\n", s.max_error, s.pass ? "true" : "false", last ? "" : ",");
+        }
+    }
+    printf("  ],\n");
+    printf("  \"pass\": %s\n}\n", failed ? "false" : "true");
+
+    return simFinish(stdout, failed, "Ramp check failed");
+}
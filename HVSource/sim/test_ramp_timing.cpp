@@ -0,0 +1,98 @@
+#include "SimHardware.h"
+#include "../Controller.h"
+#include "../../Common/SimHarness.h"
+#include <unistd.h>
+
+// End to end ramp timing on the simulated board : both sources ramp at the same time through the serial
+// commands and the ramp thread, each with its own slew rate. SimDac stamps the first and the last write that
+// changes each voltage channel (B and D), the ramp must last target / slew rate within the tolerance.
+// The ramp thread runs on the host scheduler, so a loaded machine can stretch the last write. This check is
+// kept out of the default CTest set (ctest -C Timing runs it), hvsource_test_ramp checks RampEngine exactly.
+// Results are written as JSON, the exit code is 2 if a ramp is off by more than the tolerance.
+//
+// Usage : hvsource_test_ramp_timing [--tolerance ms]
+
+#define TEST_WAIT_MS 3000
+#define TEST_DEFAULT_TOLERANCE_MS 5.0
+
+struct RampCase
+{
+    int source;
+    int target;     // [V]
+    float slew;     // [V/s]
+    int channel;    // Voltage DAC channel
+};
+
+static const RampCase Cases[] = { { 1, 1000, 1000.0f, 1 }, { 2, 2000, 4000.0f, 3 } };
+#define NUM_CASES (int)(sizeof(Cases) / sizeof(Cases[0]))
+
+static void send(SimSerial& serial, const char* line)
+{
+    serial.push(line, strlen(line));
+    std::this_thread::sleep_for(20ms);
+}
+
+int main(int argc, char** argv)
+{
+    double tolerance = TEST_DEFAULT_TOLERANCE_MS;
+    const SimOption Options[] = { { "--tolerance", SIM_OPT_DOUBLE, &tolerance, "ms" } };
+    if(!simParseArgs(argc, argv, Options))
+        return SIM_EXIT_USAGE;
+
+    static SimDac dac;
+    static SimEnable en;
+    static SimAdc adc(&dac, &en);
+    static SimSerial serial;
+    static SimLcd lcd;
+    static SimLed led;
+    static SimStorage storage;
+
+    adc.setNoise(0.0f);
+
+    HVHardware hw;
+    hw.dac = &dac;
+    hw.adc = &adc;
+    hw.en = &en;
+    hw.serial = &serial;
+    hw.lcd = &lcd;
+    hw.led = &led;
+    hw.storage = &storage;
+    controllerInit(hw);
+
+    char line[64];
+    for(const RampCase& c : Cases)
+    {
+        snprintf(line, sizeof(line), "%dSR%.0f\r%dSI400\r%dSV%d\r", c.source, c.slew, c.source, c.source, c.target);
+        send(serial, line);
+    }
+
+    // Both ramps start from 0 V with the power on
+    dac.clearChanges();
+    serial.push("1PO1;2PO1\r", 10);
+    std::this_thread::sleep_for(std::chrono::milliseconds(TEST_WAIT_MS));
+
+    bool failed = false;
+    printf("{\n");
+    printf("  \"test\": \"hvsource_ramp_timing\",\n");
+    printf("  \"tolerance_ms\": %.1f,\n", tolerance);
+    printf("  \"ramps\": [\n");
+    for(int i = 0; i < NUM_CASES; i++)
+    {
+        const RampCase& c = Cases[i];
+        double expected = c.target / c.slew * 1000.0;
+        bool ramped = dac.changes(c.channel) > 0;
+        double measured = ramped ? (uint32_t)(dac.lastChange(c.channel) - dac.firstChange(c.channel)) * 1e-3 : 0.0;
+        bool ok = ramped && fabs(measured - expected) <= tolerance;
+        if(!ok) failed = true;
+
+        printf("    { \"source\": %d, \"target_v\": %d, \"slew\": %.0f, \"writes\": %lu, \"expected_ms\": %.2f, \"measured_ms\": %.2f, \"pass\": %s }%s\n",
+               c.source, c.target, c.slew, (unsigned long)dac.changes(c.channel), expected, measured, ok ? "true" : "false",
+               i < NUM_CASES - 1 ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    int result = simFinish(stdout, failed, "Ramp duration off by more than %.1f ms", tolerance);
+
+    // The firmware threads never return, skip the static destructors they are still waiting on
+    _exit(result);
+}
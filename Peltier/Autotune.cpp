@@ -0,0 +1,146 @@
+#include "Autotune.h"
+#include <cmath>
+
+RelayAutotune::RelayAutotune(float out_min, float out_max)
+    : out_min(out_min), out_max(out_max), state(AUTOTUNE_IDLE), ku(0.0f), tu(0.0f), gains{ 0.0f, 0.0f, 0.0f, 0.0f }
+{
+}
+
+void RelayAutotune::start(const AutotuneConfig& c)
+{
+    config = c;
+    if(config.cycles < 1) config.cycles = 1;
+    if(config.cycles > AUTOTUNE_MAX_CYCLES) config.cycles = AUTOTUNE_MAX_CYCLES;
+
+    state = AUTOTUNE_RUNNING;
+    t = 0.0f;
+    high = false;
+    bias = (out_min + out_max) * 0.5f;
+    swing = (out_max - out_min) * 0.5f;
+    t_switch = -1.0f;
+    t_high = 0.0f;
+    t_low = 0.0f;
+    peak_max = -INFINITY;
+    peak_min = INFINITY;
+    cycles = 0;
+    sum_amplitude = 0.0f;
+    sum_period = 0.0f;
+}
+
+void RelayAutotune::abort()
+{
+    if(state == AUTOTUNE_RUNNING)
+        state = AUTOTUNE_IDLE;
+}
+
+float RelayAutotune::update(float measurement, float dt)
+{
+    if(state != AUTOTUNE_RUNNING)
+        return out_min;
+
+    t += dt;
+    if(t > config.timeout)
+    {
+        state = AUTOTUNE_FAILED;
+        return out_min;
+    }
+
+    if(high) t_high += dt;
+    else     t_low += dt;
+
+    if(measurement > peak_max) peak_max = measurement;
+    if(measurement < peak_min) peak_min = measurement;
+
+    // A period ends on every switch to the high side
+    if(!high && measurement > config.setpoint + config.hysteresis)
+    {
+        high = true;
+
+        if(t_switch >= 0.0f)
+        {
+            cycles++;
+            float share = t_high / (t_high + t_low);
+
+            if(cycles == 2)
+            {
+                // Output holding the setpoint, from the full swing period
+                bias = out_min + (out_max - out_min) * share;
+            }
+            else if(cycles > 2)
+            {
+                sum_amplitude += (peak_max - peak_min) * 0.5f;
+                sum_period += t - t_switch;
+
+                // Keep the relay centered (half step)
+                bias += swing * (share - 0.5f);
+            }
+
+            if(cycles >= 2)
+            {
+                if(bias < out_min) bias = out_min;
+                if(bias > out_max) bias = out_max;
+
+                swing = config.amplitude;
+                if(swing > bias - out_min) swing = bias - out_min;
+                if(swing > out_max - bias) swing = out_max - bias;
+            }
+
+            if(cycles >= 2 + config.cycles)
+            {
+                finish();
+                return out_min;
+            }
+        }
+
+        t_switch = t;
+        t_high = 0.0f;
+        t_low = 0.0f;
+        peak_max = measurement;
+        peak_min = measurement;
+    }
+    else if(high && measurement < config.setpoint - config.hysteresis)
+    {
+        high = false;
+    }
+
+    float u = bias + (high ? swing : -swing);
+    if(u < out_min) u = out_min;
+    if(u > out_max) u = out_max;
+    return u;
+}
+
+void RelayAutotune::finish()
+{
+    float a = sum_amplitude / config.cycles;
+    tu = sum_period / config.cycles;
+
+    if(a <= config.hysteresis || tu <= 0.0f)
+    {
+        state = AUTOTUNE_FAILED;
+        return;
+    }
+
+    ku = 4.0f * swing / (float)M_PI / sqrtf(a * a - config.hysteresis * config.hysteresis);
+    gains = computeGains(ku, tu, config.rule);
+    state = AUTOTUNE_DONE;
+}
+
+PIDGains RelayAutotune::computeGains(float ku, float tu, TuningRule rule)
+{
+    float kp, ti, td;
+    switch(rule)
+    {
+        case TUNE_ZIEGLER_NICHOLS:
+            kp = 0.6f * ku;  ti = tu * 0.5f;  td = tu * 0.125f;
+            break;
+        case TUNE_NO_OVERSHOOT:
+            kp = 0.2f * ku;  ti = tu * 0.5f;  td = tu / 3.0f;
+            break;
+        case TUNE_TYREUS_LUYBEN:
+        default:
+            kp = ku / 2.2f;  ti = tu * 2.2f;  td = tu / 6.3f;
+            break;
+    }
+
+    return { kp, kp / ti, kp * td, td / AUTOTUNE_DERIVATIVE_N };
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include "PID.h"
+
+// Relay feedback autotuning (Astrom - Hagglund), pure logic like PID.h so it also runs on the host (see sim/).
+// While running, the output switches between bias + amplitude and bias - amplitude whenever the measurement
+// crosses the setpoint (with hysteresis), which makes the loop oscillate at its ultimate period Tu.
+// From the oscillation amplitude a the ultimate gain is Ku = 4 * amplitude / (pi * sqrt(a^2 - hysteresis^2)),
+// the PID gains then come from Ku and Tu with the selected rule.
+// A cooling only channel is far from symmetric, so the relay is centered on the output holding the setpoint (bias) :
+//   period 1 - full swing relay, brings the loop to the setpoint (transient, not used)
+//   period 2 - full swing relay, the bias is the share of the period spent on the high side
+//   then     - bias +- amplitude (less if the bias is close to a limit), the bias keeps following the time spent on
+//              each side, the amplitude and period are averaged over the next config.cycles periods
+// Call update() at a fixed rate, the output is reverse acting like the coolers (high above the setpoint).
+
+enum AutotuneState : uint8_t
+{
+    AUTOTUNE_IDLE    = 0,
+    AUTOTUNE_RUNNING = 1,
+    AUTOTUNE_DONE    = 2,
+    AUTOTUNE_FAILED  = 3    // No usable oscillation before the timeout
+};
+
+enum TuningRule : uint8_t
+{
+    TUNE_ZIEGLER_NICHOLS = 0,   // Fastest, about 25 % overshoot
+    TUNE_NO_OVERSHOOT    = 1,   // Ziegler - Nichols "no overshoot" variant
+    TUNE_TYREUS_LUYBEN   = 2    // Slow integral, robust on lagging plants
+};
+
+#define AUTOTUNE_MAX_CYCLES 8
+#define AUTOTUNE_DERIVATIVE_N 8.0f  // Derivative filter tau_d = Td / N
+
+struct AutotuneConfig
+{
+    float setpoint;
+    float amplitude;    // Relay half swing (at most)
+    float hysteresis;   // Above the measurement noise
+    uint8_t cycles;     // Oscillation periods averaged, 1 to AUTOTUNE_MAX_CYCLES
+    float timeout;      // [s]
+    TuningRule rule;
+};
+
+class RelayAutotune
+{
+public:
+    RelayAutotune(float out_min, float out_max);
+
+    void start(const AutotuneConfig& config);
+    void abort();
+
+    float update(float measurement, float dt);
+
+    AutotuneState getState() const { return state; }
+
+    // Completed periods, the two full swing ones included
+    uint8_t getCycles() const { return cycles; }
+
+    // Output holding the setpoint, as far as the experiment got
+    float getBias() const { return bias; }
+
+    // Valid once AUTOTUNE_DONE
+    float getUltimateGain() const { return ku; }
+    float getUltimatePeriod() const { return tu; }
+    PIDGains getGains() const { return gains; }
+
+    static PIDGains computeGains(float ku, float tu, TuningRule rule);
+
+private:
+    void finish();
+
+private:
+    float out_min;
+    float out_max;
+    AutotuneConfig config;
+    AutotuneState state;
+
+    float t;            // Since start [s]
+    bool high;          // Relay side
+    float bias;
+    float swing;
+    float t_switch;     // Last switch to the high side
+    float t_high;       // Time on each side in the current period
+    float t_low;
+    float peak_max;
+    float peak_min;
+
+    uint8_t cycles;
+    float sum_amplitude;
+    float sum_period;
+
+    float ku;
+    float tu;
+    PIDGains gains;
+};
@@ -0,0 +1,286 @@
+#include "Commands.h"
+#include "../Common/CommandTable.h"
+#include <cstdarg>
+#include <cmath>
+
+static TempControl* control = nullptr;
+static BufferedSerial* serial = nullptr;
+
+static char last_error[ERROR_SIZE] = "No error.";
+
+// Rule of the next autotune of each channel
+static TuningRule tune_rules[PELTIER_NUM_CHANNELS] = { AUTOTUNE_DEFAULT_RULE, AUTOTUNE_DEFAULT_RULE };
+
+static char reply[REPLY_SIZE];
+static int reply_len = 0;
+static int reply_fields = 0;
+
+static void setError(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(last_error, sizeof(last_error), fmt, args);
+    va_end(args);
+}
+
+static void replyRaw(const char* data, int len)
+{
+    if(len > (int)sizeof(reply) - reply_len) len = sizeof(reply) - reply_len;
+    memcpy(reply + reply_len, data, len);
+    reply_len += len;
+}
+
+static void replyField()
+{
+    if(reply_fields++ > 0) replyRaw(",", 1);
+}
+
+static void replyInt(int32_t v)
+{
+    char data[16];
+    replyField();
+    replyRaw(data, snprintf(data, sizeof(data), "%ld", (long)v));
+}
+
+static void replyFloat(float v, int decimals = 2)
+{
+    char data[32];
+    replyField();
+    replyRaw(data, snprintf(data, sizeof(data), "%.*f", decimals, v));
+}
+
+static void replyText(const char* s)
+{
+    replyField();
+    replyRaw(s, strlen(s));
+}
+
+static void replySend()
+{
+    if(reply_len > 0)
+    {
+        replyRaw("\r\n", 2);
+        serial->write(reply, reply_len);
+    }
+    reply_len = 0;
+    reply_fields = 0;
+}
+
+// TT - Target temperature
+static void setTarget(const Command& c)
+{
+    if(!control->setTarget(c.source, c.value))
+        setError("Target temperature (%.2f C) out of range [%.0f, %.0f].", c.value, TEMP_MIN_TARGET, TEMP_MAX_TARGET);
+}
+
+static void getTarget(const Command& c)
+{
+    replyFloat(control->getTarget(c.source));
+}
+
+// TA - Actual temperature
+static void getTemperature(const Command& c)
+{
+    if(control->isFault(c.source))
+        setError("Channel %d thermistor is open or shorted.", c.source);
+    replyFloat(control->getTemperature(c.source));
+}
+
+// PO - Channel on/off
+static void setEnable(const Command& c)
+{
+    int value = (int)c.value;
+    if(value != 0 && value != 1)
+    {
+        setError("Power state (%d) not available. Possible values [0, 1].", value);
+        return;
+    }
+    control->enable(c.source, value);
+}
+
+static void getEnable(const Command& c)
+{
+    replyInt(control->isEnabled(c.source));
+}
+
+// DU - Peltier duty cycle
+static void getDuty(const Command& c)
+{
+    replyFloat(control->getDuty(c.source), 3);
+}
+
+// PG - PID gains, kp,ki,kd[,tau_d]
+static void setGains(const Command& c)
+{
+    PIDGains gains = control->getGains(c.source);
+    float v[4] = { gains.kp, gains.ki, gains.kd, gains.tau_d };
+
+    const char* p = c.arg;
+    int n = 0;
+    while(n < 4)
+    {
+        char* end;
+        v[n] = strtof(p, &end);
+        if(end == p) break;
+        n++;
+        if(*end != ',') { p = end; break; }
+        p = end + 1;
+    }
+
+    if(n < 3 || *p != '\0' || !control->setGains(c.source, { v[0], v[1], v[2], v[3] }))
+        setError("PID gains (%s) not valid. Expected kp,ki,kd[,tau_d], all positive.", c.arg);
+}
+
+static void getGains(const Command& c)
+{
+    PIDGains gains = control->getGains(c.source);
+    replyFloat(gains.kp, 4);
+    replyFloat(gains.ki, 4);
+    replyFloat(gains.kd, 4);
+    replyFloat(gains.tau_d, 4);
+}
+
+// AT - Autotune start/abort
+static void setAutotune(const Command& c)
+{
+    int value = (int)c.value;
+    if(value == 0)
+    {
+        control->abortAutotune(c.source);
+    }
+    else if(value == 1)
+    {
+        if(!control->startAutotune(c.source, tune_rules[c.source - 1]))
+            setError("Channel %d must be on with a working thermistor to autotune.", c.source);
+    }
+    else
+    {
+        setError("Autotune action (%d) not available. Possible values [0, 1].", value);
+    }
+}
+
+static void getAutotune(const Command& c)
+{
+    replyInt(control->getAutotuneState(c.source));
+    replyInt(control->getAutotuneCycles(c.source));
+}
+
+// AR - Autotune rule
+static void setRule(const Command& c)
+{
+    int value = (int)c.value;
+    if(value < TUNE_ZIEGLER_NICHOLS || value > TUNE_TYREUS_LUYBEN)
+    {
+        setError("Tuning rule (%d) not available. Possible values [0, 2].", value);
+        return;
+    }
+    tune_rules[c.source - 1] = (TuningRule)value;
+}
+
+static void getRule(const Command& c)
+{
+    replyInt(tune_rules[c.source - 1]);
+}
+
+// LT - Control loop timing
+static void resetTiming(const Command& c)
+{
+    control->resetTiming();
+}
+
+static void getTiming(const Command& c)
+{
+    LoopTiming::Stats t = control->timing();
+    replyInt(t.passes > 1 ? t.min_jitter_us : 0);
+    replyInt(t.passes > 1 ? t.max_jitter_us : 0);
+    replyInt(t.max_latency_us);
+    replyInt(t.missed);
+}
+
+// EE - Last error
+static void getLastError(const Command& c)
+{
+    replyText(last_error);
+}
+
+static constexpr CommandDesc PeltierCommandList[] = {
+    { CMD_CODE('T', 'T'), CMD_ARG_FLOAT, 0,               &setTarget,   &getTarget      },
+    { CMD_CODE('T', 'A'), CMD_ARG_NONE,  0,               nullptr,      &getTemperature },
+    { CMD_CODE('P', 'O'), CMD_ARG_INT,   0,               &setEnable,   &getEnable      },
+    { CMD_CODE('D', 'U'), CMD_ARG_NONE,  0,               nullptr,      &getDuty        },
+    { CMD_CODE('P', 'G'), CMD_ARG_TEXT,  0,               &setGains,    &getGains       },
+    { CMD_CODE('A', 'T'), CMD_ARG_INT,   0,               &setAutotune, &getAutotune    },
+    { CMD_CODE('A', 'R'), CMD_ARG_INT,   0,               &setRule,     &getRule        },
+    { CMD_CODE('L', 'T'), CMD_ARG_NONE,  CMD_FLAG_GLOBAL, &resetTiming, &getTiming      },
+    { CMD_CODE('E', 'E'), CMD_ARG_NONE,  CMD_FLAG_GLOBAL, nullptr,      &getLastError   }
+};
+
+static constexpr CommandTable<CMD_COUNT(PeltierCommandList)> PeltierCommands = makeCommandTable(PeltierCommandList);
+static_assert(PeltierCommands.unique(), "Duplicated Peltier command code");
+
+static void dispatch(const Command& c)
+{
+    char code[3] = { (char)(c.cmd >> 8 & 0xFF), (char)(c.cmd & 0xFF), '\0' };
+
+    switch(dispatchCommand(PeltierCommands, c))
+    {
+        case DISPATCH_OK:
+            break;
+        case DISPATCH_NO_SOURCE:
+            setError("Command error. Specified channel not available. Possible values [1, 2].");
+            break;
+        case DISPATCH_READ_ONLY:
+            setError("Command [%s] can only be read.", code);
+            break;
+        case DISPATCH_WRITE_ONLY:
+            setError("Command [%s] can not be read.", code);
+            break;
+        case DISPATCH_BAD_ARG:
+            setError("Command error. Value (%s) of [%s] is not a number.", c.arg, code);
+            break;
+        default:
+            setError("Command [%s] not recognized.", code);
+            break;
+    }
+}
+
+void commandsInit(TempControl* c, BufferedSerial* s)
+{
+    control = c;
+    serial = s;
+}
+
+void commandsPoll()
+{
+    static CommandParser parser(SERIAL_STOP_BYTE);
+
+    while(serial->readable())
+    {
+        char byte;
+        if(serial->read(&byte, 1) != 1)
+            break;
+
+        CommandStatus status = parser.feed(byte);
+        if(status == CMD_OVERFLOW)
+        {
+            setError("Command error. Command too long (max %d bytes).", CMD_LINE_SIZE - 1);
+        }
+        else if(status == CMD_READY)
+        {
+            // Batch replies keep one field per command (empty for sets), separated like the commands
+            bool batch = parser.isBatch();
+            bool first = true;
+            Command c;
+            while((status = parser.next(c)) != CMD_NONE)
+            {
+                if(batch && !first) replyRaw(";", 1);
+                first = false;
+                reply_fields = 0;
+
+                if(status == CMD_READY) dispatch(c);
+                else                    setError("Command error. Malformed command, expected format nCCv.");
+            }
+            replySend();
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "mbed-os/mbed.h"
+#include "TempControl.h"
+
+// Serial commands of the Peltier controller, nCCv<stop byte> like the HV controller (see the README for the list).
+// Lines go through the shared parser and command table (Common/CommandParser.h, Common/CommandTable.h),
+// replies are sent once per line, the fields of a batch separated by ';'.
+// Everything runs in the thread calling commandsPoll(), never in the control thread.
+
+#define SERIAL_STOP_BYTE '\r'
+#define REPLY_SIZE 128
+#define ERROR_SIZE 96
+
+void commandsInit(TempControl* control, BufferedSerial* serial);
+
+// Handles the bytes received so far, never waits for more
+void commandsPoll();
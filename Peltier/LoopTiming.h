@@ -0,0 +1,62 @@
+#pragma once
+#include "mbed-os/mbed.h"
+#include "us_ticker_api.h"
+
+// Timing of a fixed rate loop woken up by a timer interrupt, all in us ticker time :
+//   jitter  - interval between two wake-ups minus the nominal period
+//   latency - delay from the timer interrupt to the thread running
+//   missed  - timer periods that went by without a pass (the loop overran)
+// record() is called by the loop thread, get() / reset() from any thread.
+
+class LoopTiming
+{
+public:
+    struct Stats
+    {
+        uint32_t passes;
+        int32_t min_jitter_us;
+        int32_t max_jitter_us;
+        uint32_t max_latency_us;
+        uint32_t missed;
+    };
+
+    LoopTiming(uint32_t period_us) : period_us(period_us) { reset(); }
+
+    // t_tick : time of the timer interrupt, ticks : timer periods since the last pass
+    void record(uint32_t t_tick, uint32_t t_wake, uint32_t ticks)
+    {
+        CriticalSectionLock lock;
+
+        if(stats.passes > 0 && ticks == 1)
+        {
+            int32_t jitter = (int32_t)(t_wake - last_wake - period_us);
+            if(jitter < stats.min_jitter_us) stats.min_jitter_us = jitter;
+            if(jitter > stats.max_jitter_us) stats.max_jitter_us = jitter;
+        }
+        if(ticks > 1) stats.missed += ticks - 1;
+
+        uint32_t latency = t_wake - t_tick;
+        if(latency > stats.max_latency_us) stats.max_latency_us = latency;
+
+        last_wake = t_wake;
+        stats.passes++;
+    }
+
+    Stats get() const
+    {
+        CriticalSectionLock lock;
+        return stats;
+    }
+
+    void reset()
+    {
+        CriticalSectionLock lock;
+        stats = { 0, INT32_MAX, INT32_MIN, 0, 0 };
+        last_wake = 0;
+    }
+
+private:
+    uint32_t period_us;
+    uint32_t last_wake;
+    Stats stats;
+};
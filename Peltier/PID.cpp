@@ -0,0 +1,57 @@
+#include "PID.h"
+
+PID::PID(const PIDGains& gains, float out_min, float out_max, PIDDirection dir)
+    : gains(gains), out_min(out_min), out_max(out_max), sign(dir == PID_REVERSE ? -1.0f : 1.0f)
+{
+    reset(0.0f, out_min);
+}
+
+void PID::reset(float measurement, float output)
+{
+    integ = output;
+    deriv = 0.0f;
+    last_pv = measurement;
+    out = output;
+    first = true;
+}
+
+void PID::setLimits(float out_min, float out_max)
+{
+    this->out_min = out_min;
+    this->out_max = out_max;
+}
+
+float PID::update(float setpoint, float measurement, float dt)
+{
+    float e = sign * (setpoint - measurement);
+
+    // First sample after a reset has no slope yet
+    float dpv = first ? 0.0f : measurement - last_pv;
+    last_pv = measurement;
+    first = false;
+
+    // Tustin discretization of kd * s / (tau_d * s + 1), on -measurement
+    float a = 2.0f * gains.tau_d;
+    deriv = (-2.0f * sign * gains.kd * dpv + (a - dt) * deriv) / (a + dt);
+
+    float p = gains.kp * e;
+    float i = integ + gains.ki * dt * e;
+    float u = p + i + deriv;
+
+    // Conditional integration, keep the old integrator if it would only wind up
+    bool high = u > out_max;
+    bool low = u < out_min;
+    if(!((high && e > 0.0f) || (low && e < 0.0f)))
+        integ = i;
+
+    // The integrator alone never goes past the limits either
+    if(integ > out_max) integ = out_max;
+    if(integ < out_min) integ = out_min;
+
+    u = p + integ + deriv;
+    if(u > out_max) u = out_max;
+    if(u < out_min) u = out_min;
+
+    out = u;
+    return u;
+}
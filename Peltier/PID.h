@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+
+// Discrete PID for the temperature loops, pure logic (no Mbed) so it also runs against the host thermal model (see sim/).
+// - Derivative on the measurement (no kick on setpoint changes), low pass filtered with time constant tau_d
+// - Anti-windup by conditional integration : the integrator is frozen while the output is saturated
+//   and the error would push it further into saturation
+// - Reverse acting mode for the coolers : the output rises when the measurement is above the setpoint
+// Call update() at a fixed rate, dt is the sampling period.
+
+enum PIDDirection : uint8_t
+{
+    PID_DIRECT  = 0,
+    PID_REVERSE = 1
+};
+
+struct PIDGains
+{
+    float kp;       // [output / unit]
+    float ki;       // [output / (unit s)]
+    float kd;       // [output s / unit]
+    float tau_d;    // Derivative filter time constant [s]
+};
+
+class PID
+{
+public:
+    PID(const PIDGains& gains, float out_min, float out_max, PIDDirection dir);
+
+    float update(float setpoint, float measurement, float dt);
+
+    // Bumpless restart : the next update() starts from output with no derivative kick
+    void reset(float measurement, float output);
+
+    void setGains(const PIDGains& g) { gains = g; }
+    const PIDGains& getGains() const { return gains; }
+
+    void setLimits(float out_min, float out_max);
+
+    float getOutput() const { return out; }
+    float getIntegral() const { return integ; }
+    bool isSaturated() const { return out <= out_min || out >= out_max; }
+
+private:
+    PIDGains gains;
+    float out_min;
+    float out_max;
+    float sign;
+
+    float integ;
+    float deriv;
+    float last_pv;
+    float out;
+    bool first;
+};
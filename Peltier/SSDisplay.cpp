@@ -1,74 +1,110 @@
 #include "SSDisplay.h"
 #include <Kernel.h>
 
-DigitalOut led(LED1);
-
-SSDisplay::SSDisplay(uint8_t ms, uint8_t num_displays, DDPinOut pins, PinName* muxs)
-    : ms(ms), num_displays(num_displays), c_digit(SSRight), c_number(0), 
-      pin_a(pins.a_pin),
-      pin_b(pins.b_pin),
-      pin_c(pins.c_pin),
-      pin_d(pins.d_pin),
-      pin_e(pins.e_pin),
-      pin_f(pins.f_pin),
-      pin_g(pins.g_pin)
+SSDisplay::SSDisplay(uint16_t refresh_hz, uint8_t num_displays, const SegmentPorts& segments, PinName* muxs)
+    : num_digits(num_displays * 2), on_us(0), brightness(0), c_digit(0), segments(segments)
 {
-    display_data = new uint8_t[num_displays * 2]; // This is inefficient but is easier (just wastes ram wtv, keep unless we are on a strech)
+    assert(num_displays > 0 && num_displays <= SS_MAX_DISPLAYS);
+
+    slot_us = 1000000 / ((uint32_t)refresh_hz * num_digits);
+    if(slot_us < SS_MIN_SLOT_US) slot_us = SS_MIN_SLOT_US;
+
+    ports.reserve(segments.count);
+    for(int i = 0; i < segments.count; i++)
+    {
+        ports.emplace_back(segments.ports[i].port, segments.ports[i].mask);
+    }
+
+    // All digits start blank (segment pins high, common anode)
+    frame = new uint32_t[num_digits * segments.count];
+    for(uint8_t d = 0; d < num_digits; d++)
+    {
+        for(int i = 0; i < segments.count; i++)
+        {
+            frame[d * segments.count + i] = segments.ports[i].mask;
+        }
+    }
     
-    for(uint8_t i = 0; i < num_displays * 2; i++) // Muxes can be shortened if necessary (no left over pins)
+    for(uint8_t i = 0; i < num_digits; i++) // Muxes can be shortened if necessary (no left over pins)
     {
-        this->muxs.push_back(muxs[i]);
+        this->muxs.emplace_back(muxs[i], 0);
     }
+
+    setBrightness(SS_DEFAULT_BRIGHTNESS);
 }
 
 SSDisplay::~SSDisplay()
 {
-    delete[] display_data;
+    stop();
+    delete[] frame;
 }
 
 void SSDisplay::show(uint8_t display, uint8_t value)
 {
-    assert(display < num_displays);
-    display_data[2 * display    ] = value % 10;
-    display_data[2 * display + 1] = value / 10;
+    assert(display < num_digits / 2);
+    uint8_t digits[2] = { (uint8_t)(value % 10), (uint8_t)(value / 10 % 10) };
+
+    // Single words, the ISR can at worst show one slot of a half updated digit
+    for(int d = 0; d < 2; d++)
+    {
+        uint32_t* row = &frame[(2 * display + d) * segments.count];
+        for(int i = 0; i < segments.count; i++)
+        {
+            row[i] = segments.ports[i].digits[digits[d]];
+        }
+    }
 }
 
 void SSDisplay::start()
 {
-    ticker.attach(callback(this, &SSDisplay::interrupt), std::chrono::milliseconds(ms));
+    ticker.attach(callback(this, &SSDisplay::slotStart), std::chrono::microseconds(slot_us));
 }
 
-void SSDisplay::interrupt()
+void SSDisplay::stop()
 {
-    display(c_number, c_digit);
-    bool cond = (c_digit == SSRight);
-    c_digit  = cond ? SSLeft : SSRight;
-    c_number = cond ? c_number : (c_number + 1) % num_displays;
+    ticker.detach();
+    timeout.detach();
+    for(DigitalOut& mux : muxs)
+    {
+        mux.write(0);
+    }
 }
 
-void SSDisplay::display(uint8_t n, uint8_t d)
+void SSDisplay::setBrightness(uint8_t percent)
 {
-    uint8_t curr_digit = 2 * n + d;
+    if(percent > 100) percent = 100;
+    brightness = percent;
 
-    // Assume all other mux pins are off by design
-    muxs[curr_digit].write(1);
-    uint8_t dig = display_data[curr_digit];
-    uint8_t data = SEG[dig];
+    // The timeout must not run into the next slot, the next digit would go off with it
+    uint32_t on = slot_us * percent / 100;
+    if(percent < 100 && on > slot_us - SS_GUARD_US) on = slot_us - SS_GUARD_US;
+    on_us = on;
+}
 
+void SSDisplay::slotStart()
+{
+    // Previous digit off first, no ghosting of the new segments on it
+    muxs[c_digit].write(0);
+    c_digit = (c_digit + 1) % num_digits;
 
-    // Negate for common anode config (mcu max sink spec = 80 mA)
-    pin_a.write(!((data & 0b01000000) == 0b01000000));
-    pin_b.write(!((data & 0b00100000) == 0b00100000));
-    pin_c.write(!((data & 0b00010000) == 0b00010000));
-    pin_d.write(!((data & 0b00001000) == 0b00001000));
-    pin_e.write(!((data & 0b00000100) == 0b00000100));
-    pin_f.write(!((data & 0b00000010) == 0b00000010));
-    pin_g.write(!((data & 0b00000001) == 0b00000001));
+    uint32_t on = on_us;
+    if(on == 0)
+        return;
 
-    //int us = (ms * 1000 - timer.read_us());
+    // Segments first, the digit only lights up with its final value
+    const uint32_t* row = &frame[c_digit * segments.count];
+    for(int i = 0; i < segments.count; i++)
+    {
+        ports[i].write(row[i]);
+    }
+    muxs[c_digit].write(1);
 
-    //if(us > 0)
-    wait_us(ms * 500.0); // Aprox 50% duty cycle (implement all this code in a thread instead)
+    // Full brightness stays lit until the next slot
+    if(on < slot_us)
+        timeout.attach(callback(this, &SSDisplay::slotEnd), std::chrono::microseconds(on));
+}
 
-    muxs[curr_digit].write(0);
-}
\ No newline at end of file
+void SSDisplay::slotEnd()
+{
+    muxs[c_digit].write(0);
+}
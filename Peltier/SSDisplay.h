@@ -1,14 +1,20 @@
+#pragma once
 #include "mbed-os/mbed.h"
+#include "../Common/ConstTable.h"
 #include <vector>
 
 #define SSRight 0
 #define SSLeft 1
 
-constexpr uint8_t operator""Hz(unsigned long long f)
-{
-    int v = (uint8_t)(1000.0f / f);
-    return v > 0 ? v : 1000;
-}
+#define SS_NUM_SEGMENTS 7
+#define SS_NUM_DIGITS 10
+
+// Each display has 2 digits, each digit its own mux pin
+#define SS_MAX_DISPLAYS 8
+#define SS_DEFAULT_REFRESH_HZ 100   // Whole display, flicker free above ~80 Hz
+#define SS_DEFAULT_BRIGHTNESS 50    // [%] of each digit slot the digit is lit
+#define SS_MIN_SLOT_US 100          // Shortest digit slot, keeps the ISR load low
+#define SS_GUARD_US 20              // Below 100 %, the digit goes off at least this long before the next slot
 
 // No need for a decimal point, unless a finer-tuned value is needed
 struct DDPinOut
@@ -22,54 +28,133 @@ struct DDPinOut
     PinName g_pin;
 };
 
+// Sets the digits from the segments (bit 6 - a ... bit 0 - g)
+static constexpr uint8_t SEG[SS_NUM_DIGITS] = {
+    0x7E, // 0
+    0x30, // 1
+    0x6D, // 2
+    0x79, // 3
+    0x33, // 4
+    0x5B, // 5
+    0x5F, // 6
+    0x70, // 7
+    0x7F, // 8
+    0x7B  // 9
+};
+
+// The segment pins can be spread over several GPIO ports, each port gets a single masked write per digit.
+// The writes are generated at compile time from the pins (STM32 pin names encode the port and pin number) :
+//   static constexpr SegmentPorts segments = makeSegmentPorts(pins);
+struct SegmentPort
+{
+    PortName port;
+    uint32_t mask;                                  // Segment pins of this port
+    ConstTable<uint32_t, SS_NUM_DIGITS> digits;     // Port value showing each digit
+};
+
+struct SegmentPorts
+{
+    int count;
+    SegmentPort ports[SS_NUM_SEGMENTS];
+};
+
+constexpr PinName segmentPin(const DDPinOut& pins, int segment)
+{
+    return segment == 0 ? pins.a_pin :
+           segment == 1 ? pins.b_pin :
+           segment == 2 ? pins.c_pin :
+           segment == 3 ? pins.d_pin :
+           segment == 4 ? pins.e_pin :
+           segment == 5 ? pins.f_pin : pins.g_pin;
+}
+
+// Value of the segment pins of port showing a digit
+struct SegmentPortDigit
+{
+    DDPinOut pins;
+    PortName port;
+
+    constexpr uint32_t operator()(int digit) const
+    {
+        uint32_t value = 0;
+        for(int s = 0; s < SS_NUM_SEGMENTS; s++)
+        {
+            PinName pin = segmentPin(pins, s);
+            bool lit = (SEG[digit] & (0b01000000 >> s)) != 0;
+
+            // Negate for common anode config (mcu max sink spec = 80 mA)
+            if(STM_PORT(pin) == (uint32_t)port && !lit) value |= 1u << STM_PIN(pin);
+        }
+        return value;
+    }
+};
+
+constexpr SegmentPorts makeSegmentPorts(const DDPinOut& pins)
+{
+    SegmentPorts out{};
+    for(int s = 0; s < SS_NUM_SEGMENTS; s++)
+    {
+        PinName pin = segmentPin(pins, s);
+        PortName port = (PortName)STM_PORT(pin);
+
+        int p = 0;
+        while(p < out.count && out.ports[p].port != port) p++;
+        if(p == out.count)
+        {
+            out.ports[p].port = port;
+            out.ports[p].digits = makeTable<uint32_t, SS_NUM_DIGITS>(SegmentPortDigit{ pins, port });
+            out.count++;
+        }
+        out.ports[p].mask |= 1u << STM_PIN(pin);
+    }
+    return out;
+}
+
+// Multiplexing is driven by two timer interrupts per digit, nothing waits :
+//   ticker  - start of a digit slot, previous digit off, segments written from the frame buffer, digit on
+//   timeout - end of the lit part of the slot (brightness), digit off
+// The frame buffer holds the port values of every digit, show() updates it and the ISRs only copy it out.
 class SSDisplay
 {
 public:
-    SSDisplay(uint8_t ms, uint8_t num_displays, DDPinOut pins, PinName* muxs);
+    // segments must outlive the display (make it static constexpr), muxs holds 2 pins per display (right digit first)
+    SSDisplay(uint16_t refresh_hz, uint8_t num_displays, const SegmentPorts& segments, PinName* muxs);
     ~SSDisplay();
 
     void show(uint8_t display, uint8_t value);
     void start();
+    void stop();
+
+    // [%] of each digit slot the digit is lit, 0 blanks the display
+    void setBrightness(uint8_t percent);
+    uint8_t getBrightness() const { return brightness; }
+
+    uint8_t getNumDisplays() const { return num_digits / 2; }
+
+    // Actual refresh rate of the whole display, the slot is rounded to whole us
+    float getRefreshRate() const { return 1e6f / (slot_us * num_digits); }
 
 private:
-    void interrupt();
-    void display(uint8_t n, uint8_t d);
+    void slotStart();
+    void slotEnd();
 
 private:
-    uint8_t ms;
-    uint8_t num_displays;
+    uint8_t num_digits;
+    uint32_t slot_us;
+    volatile uint32_t on_us;
+    uint8_t brightness;
     uint8_t c_digit;
-    uint8_t c_number;
 
-    uint8_t* display_data = nullptr;
+    // Port values of each digit [digit * segments.count + port]
+    uint32_t* frame = nullptr;
 
-    // Pins for 7seg
-    DigitalOut pin_a;
-    DigitalOut pin_b;
-    DigitalOut pin_c;
-    DigitalOut pin_d;
-    DigitalOut pin_e;
-    DigitalOut pin_f;
-    DigitalOut pin_g;
+    // Segment pins, one masked write per port
+    const SegmentPorts& segments;
+    std::vector<PortOut> ports;
 
     // Mux pins for all digits
     std::vector<DigitalOut> muxs;
-    
-    // TODO : Stop using IRQs and create a thread since the hardware is running a RTOS
-    // Controls the mux via irqs
-    Ticker ticker;
 
-    // Sets the digits from the segments
-    const uint8_t SEG[10] = {
-        0x7E, // 0
-        0x30, // 1
-        0x6D, // 2
-        0x79, // 3
-        0x33, // 4
-        0x5B, // 5
-        0x5F, // 6
-        0x70, // 7
-        0x7F, // 8
-        0x7B  // 9
-    };
+    Ticker ticker;
+    Timeout timeout;
 };
@@ -0,0 +1,27 @@
+#pragma once
+
+// Temperature loop settings shared by the firmware and the host simulation (sim/)
+
+#define PELTIER_NUM_CHANNELS 2
+
+#define TEMP_CONTROL_PERIOD_MS 100      // Fixed sampling period of both loops
+#define TEMP_MIN_TARGET -10.0f          // [C]
+#define TEMP_MAX_TARGET 40.0f           // [C]
+#define TEMP_DEFAULT_TARGET 20.0f       // [C]
+
+// Cooling power only, duty cycle of the Peltier drivers
+#define TEMP_OUT_MIN 0.0f
+#define TEMP_OUT_MAX 1.0f
+
+// Tuned on the host thermal model (sim/ThermalModel.h) : no overshoot from 25 C down to 0 C, 10 C step settles in ~105 s
+#define TEMP_DEFAULT_KP 0.8f
+#define TEMP_DEFAULT_KI 0.015f
+#define TEMP_DEFAULT_KD 1.0f
+#define TEMP_DEFAULT_TAU_D 2.0f
+
+// Relay autotune (Autotune.h), the relay swings the duty by +-amplitude around the output holding the target
+#define AUTOTUNE_DEFAULT_AMPLITUDE 0.3f
+#define AUTOTUNE_DEFAULT_HYSTERESIS 0.1f    // [C], above the sensor noise
+#define AUTOTUNE_DEFAULT_CYCLES 4
+#define AUTOTUNE_DEFAULT_TIMEOUT 3600.0f    // [s]
+#define AUTOTUNE_DEFAULT_RULE TUNE_TYREUS_LUYBEN   // No overshoot on the thermal model, the others overshoot
@@ -0,0 +1,273 @@
+#include "TempControl.h"
+#include "kvstore_global_api.h"
+#include <cmath>
+
+#define TEMP_FLAG_TICK 0x01
+
+static const PIDGains DefaultGains = { TEMP_DEFAULT_KP, TEMP_DEFAULT_KI, TEMP_DEFAULT_KD, TEMP_DEFAULT_TAU_D };
+static const char* GainKeys[PELTIER_NUM_CHANNELS] = { "/kv/pid_gains1", "/kv/pid_gains2" };
+
+static bool validGains(const PIDGains& g)
+{
+    // Also false for NAN
+    return g.kp >= 0.0f && g.ki >= 0.0f && g.kd >= 0.0f && g.tau_d >= 0.0f;
+}
+
+TempControl::Channel::Channel(const PeltierChannelPins& pins)
+    : sensor(pins.sensor), pwm(pins.pwm), pid(DefaultGains, TEMP_OUT_MIN, TEMP_OUT_MAX, PID_REVERSE),
+      tuner(TEMP_OUT_MIN, TEMP_OUT_MAX), target(TEMP_DEFAULT_TARGET), temperature(NAN), duty(0.0f), enabled(false),
+      fault(false), store(false), restart(true)
+{
+    pwm.period_us(PELTIER_PWM_PERIOD_US);
+    pwm.write(0.0f);
+}
+
+TempControl::TempControl(const PeltierChannelPins* pins, SSDisplay& display)
+    : display(display), thread(osPriorityHigh, TEMP_STACK_SIZE, nullptr, "control"), ticks(0), t_tick(0),
+      loop_timing(TEMP_CONTROL_PERIOD_MS * 1000)
+{
+    for(int i = 0; i < PELTIER_NUM_CHANNELS; i++)
+    {
+        channels[i] = new Channel(pins[i]);
+        loadGains(i);
+    }
+}
+
+void TempControl::start()
+{
+    thread.start(callback(this, &TempControl::loop));
+    ticker.attach(callback(this, &TempControl::tick), std::chrono::milliseconds(TEMP_CONTROL_PERIOD_MS));
+}
+
+bool TempControl::setTarget(int ch, float target)
+{
+    if(target < TEMP_MIN_TARGET || target > TEMP_MAX_TARGET)
+        return false;
+    channels[ch - 1]->target = target;
+    return true;
+}
+
+float TempControl::getTarget(int ch) const
+{
+    return channels[ch - 1]->target;
+}
+
+float TempControl::getTemperature(int ch) const
+{
+    return channels[ch - 1]->temperature;
+}
+
+float TempControl::getDuty(int ch) const
+{
+    return channels[ch - 1]->duty;
+}
+
+bool TempControl::isFault(int ch) const
+{
+    return channels[ch - 1]->fault;
+}
+
+void TempControl::enable(int ch, bool on)
+{
+    pid_mutex.lock();
+    Channel* c = channels[ch - 1];
+    if(on && !c->enabled) c->restart = true;
+    if(!on) c->tuner.abort();
+    c->enabled = on;
+    pid_mutex.unlock();
+}
+
+bool TempControl::isEnabled(int ch) const
+{
+    return channels[ch - 1]->enabled;
+}
+
+bool TempControl::setGains(int ch, const PIDGains& gains)
+{
+    if(!validGains(gains))
+        return false;
+
+    pid_mutex.lock();
+    channels[ch - 1]->pid.setGains(gains);
+    channels[ch - 1]->store = true;
+    pid_mutex.unlock();
+    return true;
+}
+
+PIDGains TempControl::getGains(int ch) const
+{
+    pid_mutex.lock();
+    PIDGains gains = channels[ch - 1]->pid.getGains();
+    pid_mutex.unlock();
+    return gains;
+}
+
+bool TempControl::startAutotune(int ch, TuningRule rule)
+{
+    Channel* c = channels[ch - 1];
+    if(!c->enabled || c->fault)
+        return false;
+
+    AutotuneConfig config = { c->target, AUTOTUNE_DEFAULT_AMPLITUDE, AUTOTUNE_DEFAULT_HYSTERESIS,
+                              AUTOTUNE_DEFAULT_CYCLES, AUTOTUNE_DEFAULT_TIMEOUT, rule };
+    pid_mutex.lock();
+    c->tuner.start(config);
+    pid_mutex.unlock();
+    return true;
+}
+
+void TempControl::abortAutotune(int ch)
+{
+    pid_mutex.lock();
+    channels[ch - 1]->tuner.abort();
+    channels[ch - 1]->restart = true;
+    pid_mutex.unlock();
+}
+
+AutotuneState TempControl::getAutotuneState(int ch) const
+{
+    pid_mutex.lock();
+    AutotuneState state = channels[ch - 1]->tuner.getState();
+    pid_mutex.unlock();
+    return state;
+}
+
+uint8_t TempControl::getAutotuneCycles(int ch) const
+{
+    pid_mutex.lock();
+    uint8_t cycles = channels[ch - 1]->tuner.getCycles();
+    pid_mutex.unlock();
+    return cycles;
+}
+
+void TempControl::loadGains(int i)
+{
+    PIDGainsRecord record;
+    size_t actual = 0;
+    if(kv_get(GainKeys[i], &record, sizeof(record), &actual) != MBED_SUCCESS || actual != sizeof(record))
+        return;
+
+    // Anything else keeps the defaults
+    if(record.magic == PID_GAINS_MAGIC && validGains(record.gains))
+        channels[i]->pid.setGains(record.gains);
+}
+
+void TempControl::service()
+{
+    for(int i = 0; i < PELTIER_NUM_CHANNELS; i++)
+    {
+        Channel* c = channels[i];
+        if(!c->store)
+            continue;
+
+        PIDGainsRecord record;
+        pid_mutex.lock();
+        record.magic = PID_GAINS_MAGIC;
+        record.gains = c->pid.getGains();
+        c->store = false;
+        pid_mutex.unlock();
+
+        // Slow (flash erase), never in the control thread
+        kv_set(GainKeys[i], &record, sizeof(record), 0);
+    }
+}
+
+void TempControl::tick()
+{
+    t_tick = us_ticker_read();
+    ticks = ticks + 1;
+    tick_flags.set(TEMP_FLAG_TICK);
+}
+
+// [C], NAN if the thermistor is open or shorted
+float TempControl::readTemperature(int i)
+{
+    float v = 0.0f;
+    for(int n = 0; n < NTC_OVERSAMPLE; n++)
+    {
+        v += channels[i]->sensor.read();
+    }
+    v /= NTC_OVERSAMPLE;
+
+    if(v < NTC_MIN_RATIO || v > 1.0f - NTC_MIN_RATIO)
+        return NAN;
+
+    // Beta equation
+    float r = NTC_SERIES * v / (1.0f - v);
+    return 1.0f / (1.0f / 298.15f + logf(r / NTC_R25) / NTC_BETA) - 273.15f;
+}
+
+void TempControl::loop()
+{
+    const float dt = TEMP_CONTROL_PERIOD_MS * 0.001f;
+    uint32_t last_ticks = 0;
+
+    while(true)
+    {
+        tick_flags.wait_any(TEMP_FLAG_TICK);
+        uint32_t t_wake = us_ticker_read();
+
+        uint32_t now_ticks;
+        uint32_t tick_time;
+        {
+            CriticalSectionLock lock;
+            now_ticks = ticks;
+            tick_time = t_tick;
+        }
+        loop_timing.record(tick_time, t_wake, now_ticks - last_ticks);
+        last_ticks = now_ticks;
+
+        for(int i = 0; i < PELTIER_NUM_CHANNELS; i++)
+        {
+            Channel* c = channels[i];
+            float t = readTemperature(i);
+            c->temperature = t;
+            c->fault = std::isnan(t);
+
+            float duty = 0.0f;
+            pid_mutex.lock();
+            if(c->enabled && !c->fault)
+            {
+                if(c->tuner.getState() == AUTOTUNE_RUNNING)
+                {
+                    duty = c->tuner.update(t, dt);
+
+                    AutotuneState state = c->tuner.getState();
+                    if(state == AUTOTUNE_DONE)
+                    {
+                        c->pid.setGains(c->tuner.getGains());
+                        c->store = true;
+                    }
+                    if(state != AUTOTUNE_RUNNING)
+                    {
+                        // Back to the PID, from the output holding the setpoint
+                        c->pid.reset(t, c->tuner.getBias());
+                        duty = c->pid.update(c->target, t, dt);
+                    }
+                }
+                else
+                {
+                    if(c->restart) c->pid.reset(t, TEMP_OUT_MIN);
+                    c->restart = false;
+                    duty = c->pid.update(c->target, t, dt);
+                }
+            }
+            else
+            {
+                // Bumpless start once enabled or the sensor is back, a sensor fault also ends the autotune
+                c->tuner.abort();
+                c->restart = true;
+            }
+            pid_mutex.unlock();
+
+            c->pwm.write(duty);
+            c->duty = duty;
+
+            // Two digit displays, whole degrees
+            float shown = c->fault ? 0.0f : roundf(t);
+            display.show(i, (uint8_t)(shown < 0.0f ? 0 : shown > 99.0f ? 99 : shown));
+            if(display.getNumDisplays() >= 2 * PELTIER_NUM_CHANNELS)
+                display.show(PELTIER_NUM_CHANNELS + i, (uint8_t)(c->target < 0.0f ? 0 : roundf(c->target)));
+        }
+    }
+}
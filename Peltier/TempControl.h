@@ -0,0 +1,116 @@
+#pragma once
+#include "mbed-os/mbed.h"
+#include "PID.h"
+#include "Autotune.h"
+#include "TempConfig.h"
+#include "LoopTiming.h"
+#include "SSDisplay.h"
+
+// Closed loop temperature control of both Peltier channels.
+// A ticker wakes the control thread every TEMP_CONTROL_PERIOD_MS, each pass reads the thermistors, runs the PIDs,
+// writes the PWM duty of the Peltier drivers and shows the temperatures on the display
+// (actual on displays 0 - 1, targets on displays 2 - 3 if there are that many).
+// Channels are numbered [1, 2]. The setters can be called from any thread.
+// The gains of each channel are kept in flash (KVStore), changed gains (set or autotuned) are written by service().
+
+// NTC thermistor in a divider : 3V3 - series resistor - ADC pin - thermistor - GND
+#define NTC_R25 10000.0f        // [Ohm] at 25 C
+#define NTC_BETA 3950.0f        // [K]
+#define NTC_SERIES 10000.0f     // [Ohm]
+#define NTC_OVERSAMPLE 8        // ADC reads averaged per sample
+#define NTC_MIN_RATIO 0.01f     // Divider ratio below (shorted) or above (open) 1 - this is a sensor fault
+
+#define PELTIER_PWM_PERIOD_US 50    // 20 kHz, above the audible range
+
+#define TEMP_STACK_SIZE 2048
+
+#define PID_GAINS_MAGIC 0x50544731 // "PTG1"
+
+struct PIDGainsRecord
+{
+    uint32_t magic;
+    PIDGains gains;
+};
+
+struct PeltierChannelPins
+{
+    PinName sensor;     // Thermistor divider (analog in)
+    PinName pwm;        // Peltier driver
+};
+
+class TempControl
+{
+public:
+    // pins holds PELTIER_NUM_CHANNELS entries
+    TempControl(const PeltierChannelPins* pins, SSDisplay& display);
+
+    void start();
+
+    // Returns false if the target is out of [TEMP_MIN_TARGET, TEMP_MAX_TARGET]
+    bool setTarget(int ch, float target);
+    float getTarget(int ch) const;
+
+    // Last filtered reading [C], NAN on a sensor fault
+    float getTemperature(int ch) const;
+    float getDuty(int ch) const;
+    bool isFault(int ch) const;
+
+    // A disabled channel has its driver off, enabling it restarts the PID from zero output
+    void enable(int ch, bool on);
+    bool isEnabled(int ch) const;
+
+    // Returns false if a gain is negative or not a number
+    bool setGains(int ch, const PIDGains& gains);
+    PIDGains getGains(int ch) const;
+
+    // Relay autotune around the current target, the channel must be enabled and its sensor working.
+    // The PID takes over again with the new gains once done (or with the old ones if it failed).
+    bool startAutotune(int ch, TuningRule rule);
+    void abortAutotune(int ch);
+    AutotuneState getAutotuneState(int ch) const;
+    uint8_t getAutotuneCycles(int ch) const;
+
+    // Non realtime work (flash writes), call periodically from a low priority thread
+    void service();
+
+    LoopTiming::Stats timing() const { return loop_timing.get(); }
+    void resetTiming() { loop_timing.reset(); }
+
+private:
+    void tick();
+    void loop();
+    float readTemperature(int i);
+    void loadGains(int i);
+
+private:
+    struct Channel
+    {
+        Channel(const PeltierChannelPins& pins);
+
+        AnalogIn sensor;
+        PwmOut pwm;
+        PID pid;
+        RelayAutotune tuner;
+
+        volatile float target;
+        volatile float temperature;
+        volatile float duty;
+        volatile bool enabled;
+        volatile bool fault;
+        volatile bool store;
+        bool restart;
+    };
+
+    Channel* channels[PELTIER_NUM_CHANNELS];
+    SSDisplay& display;
+
+    // Guards the PIDs and autotuners (gains, restarts)
+    mutable Mutex pid_mutex;
+
+    Thread thread;
+    Ticker ticker;
+    EventFlags tick_flags;
+    volatile uint32_t ticks;
+    volatile uint32_t t_tick;
+    LoopTiming loop_timing;
+};
@@ -1,39 +1,42 @@
 #include "mbed-os/mbed.h"
 #include "SSDisplay.h"
+#include "TempControl.h"
+#include "Commands.h"
 
 BufferedSerial pc(USBTX, USBRX);
 
-int main()
-{
-    DDPinOut pout;
+// Segment pins a to g, the port writes of each digit are worked out by the compiler
+static constexpr DDPinOut pout = { D10, D11, D2, D3 /* TODO : Use D4 again */, D5, D6, D7 };
+static constexpr SegmentPorts segments = makeSegmentPorts(pout);
 
-    pout.a_pin = D10;
-    pout.b_pin = D11;
-    pout.c_pin = D2;
-    pout.d_pin = D3; // TODO : Use D4 again
-    pout.e_pin = D5;
-    pout.f_pin = D6;
-    pout.g_pin = D7;
+// Thermistor and Peltier driver of each channel
+static const PeltierChannelPins channel_pins[PELTIER_NUM_CHANNELS] = { { A0, D14 }, { A1, D15 } };
 
-    PinName muxs[8] = { D8, D9/*, D12, D13, PC_8, PC_6, PC_5, PC_12*/ };
+#define POLL_PERIOD_MS 20
 
-    SSDisplay display(1000Hz, 1, pout, muxs); // 1ms
-    display.show(0, 17);
-    //display.show(1, 98);
-    display.start();
+int main()
+{
+    // 2 mux pins per display (right digit first), the display count can grow up to SS_MAX_DISPLAYS
+    PinName muxs[8] = { D8, D9, D12, D13, PC_8, PC_6, PC_5, PC_12 };
 
-    ThisThread::sleep_for(std::chrono::milliseconds(1000));
+    // Actual temperatures on displays 0 - 1, targets on 2 - 3
+    SSDisplay display(SS_DEFAULT_REFRESH_HZ, 4, segments, muxs);
+    display.start();
 
-    pc.write("DONE!\n", 7);
+    // Both channels boot disabled, the Peltiers stay unpowered until a PO command
+    TempControl control(channel_pins, display);
+    control.start();
 
-    uint8_t c = 0;
+    commandsInit(&control, &pc);
 
+    // Serial commands and flash writes, the control loop runs on its own thread
     while (true)
     {
-        display.show(0, c++);
-        ThisThread::sleep_for(std::chrono::milliseconds(1000));
-        c %= 100;
+        ThisThread::sleep_for(std::chrono::milliseconds(POLL_PERIOD_MS));
+
+        commandsPoll();
+        control.service();
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cmath>
+
+// Lumped thermal model of one Peltier channel, to run the temperature loop on the host.
+// Two nodes : the crystal mount (heat capacity c, leaking to ambient through r_amb) and the sensor,
+// which lags the mount with a first order time constant. The Peltier pumps duty * q_max out of the mount,
+// less as the temperature difference to the hot side (ambient) grows towards dt_max.
+// Values are for a ~30 W module on an aluminium mount, replace them with fitted ones when available.
+
+struct ThermalParams
+{
+    float c;            // Mount heat capacity [J/K]
+    float r_amb;        // Mount to ambient thermal resistance [K/W]
+    float q_max;        // Peltier cooling power at duty 1 and no temperature difference [W]
+    float dt_max;       // Temperature difference where the cooling power drops to 0 [K]
+    float tau_sensor;   // Sensor lag [s]
+    float t_amb;        // Ambient (and hot side) temperature [C]
+};
+
+static const ThermalParams DefaultThermal = { 200.0f, 1.5f, 30.0f, 60.0f, 4.0f, 25.0f };
+
+class ThermalModel
+{
+public:
+    ThermalModel(const ThermalParams& p) : p(p), mount(p.t_amb), sensor(p.t_amb) {  }
+
+    // Advances the model by dt [s] with the given duty cycle [0, 1]
+    void step(float duty, float dt)
+    {
+        float q = duty * p.q_max * (1.0f - (p.t_amb - mount) / p.dt_max);
+        if(q < 0.0f) q = 0.0f;
+
+        mount += ((p.t_amb - mount) / p.r_amb - q) / p.c * dt;
+        sensor += (mount - sensor) / p.tau_sensor * dt;
+    }
+
+    float temperature() const { return sensor; }
+    float mountTemperature() const { return mount; }
+
+private:
+    ThermalParams p;
+    float mount;
+    float sensor;
+};
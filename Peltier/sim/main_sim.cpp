@@ -0,0 +1,183 @@
+#include "PID.h"
+#include "Autotune.h"
+#include "TempConfig.h"
+#include "ThermalModel.h"
+#include "../../Common/SimHarness.h"
+#include <cmath>
+#include <random>
+
+// Step response of one temperature loop on the thermal model of ThermalModel.h.
+// The PID runs at the firmware rate (TEMP_CONTROL_PERIOD_MS) with the firmware defaults unless gains are given,
+// the model is integrated in 1 ms steps and the sensor reading gets gaussian noise.
+//
+// Settling time : last time the temperature entered the +-band around the target and stayed there.
+// The exit code is 2 if the loop overshoots by more than --max-overshoot, does not settle within --duration
+// or (if given) takes longer than --max-settling. Results are written as JSON (stdout or --out),
+// --trace writes t, temperature, duty of the step response as CSV.
+//
+// --autotune <rule> first runs the relay experiment of Autotune.h around the target with the firmware settings
+// (rule 0 - Ziegler-Nichols, 1 - no overshoot, 2 - Tyreus-Luyben), then the step response with the tuned gains.
+//
+// Usage : peltier_sim [--target C] [--duration s] [--kp K] [--ki K] [--kd K] [--tau s] [--autotune RULE]
+//                     [--noise C] [--band C] [--max-overshoot C] [--max-settling s] [--out FILE] [--trace FILE]
+
+#define SIM_STEP_S 0.001f
+
+struct StepResult
+{
+    float settling_s;   // < 0 if not settled
+    float overshoot;    // [C] past the target, in the direction of the step
+    float final_error;  // [C]
+    float max_duty;
+};
+
+// Relay experiment from ambient, with the settings TempControl uses
+static bool autotune(TuningRule rule, float target, float noise, RelayAutotune& tuner, float& elapsed)
+{
+    ThermalModel plant(DefaultThermal);
+    std::mt19937 rng(2);
+    std::normal_distribution<float> sensor_noise(0.0f, noise);
+
+    const float dt = TEMP_CONTROL_PERIOD_MS * 0.001f;
+    const int substeps = (int)lroundf(dt / SIM_STEP_S);
+
+    AutotuneConfig config = { target, AUTOTUNE_DEFAULT_AMPLITUDE, AUTOTUNE_DEFAULT_HYSTERESIS,
+                              AUTOTUNE_DEFAULT_CYCLES, AUTOTUNE_DEFAULT_TIMEOUT, rule };
+    tuner.start(config);
+
+    elapsed = 0.0f;
+    while(tuner.getState() == AUTOTUNE_RUNNING)
+    {
+        float measured = plant.temperature() + (noise > 0.0f ? sensor_noise(rng) : 0.0f);
+        float duty = tuner.update(measured, dt);
+        for(int i = 0; i < substeps; i++)
+        {
+            plant.step(duty, SIM_STEP_S);
+        }
+        elapsed += dt;
+    }
+    return tuner.getState() == AUTOTUNE_DONE;
+}
+
+static StepResult run(const PIDGains& gains, float target, float duration, float noise, float band, FILE* trace)
+{
+    ThermalModel plant(DefaultThermal);
+    PID pid(gains, TEMP_OUT_MIN, TEMP_OUT_MAX, PID_REVERSE);
+    pid.reset(plant.temperature(), TEMP_OUT_MIN);
+
+    std::mt19937 rng(1);
+    std::normal_distribution<float> sensor_noise(0.0f, noise);
+
+    const float dt = TEMP_CONTROL_PERIOD_MS * 0.001f;
+    const int substeps = (int)lroundf(dt / SIM_STEP_S);
+    const float start = plant.temperature();
+    const float dir = target < start ? -1.0f : 1.0f;
+
+    StepResult r = { -1.0f, 0.0f, 0.0f, 0.0f };
+    float duty = 0.0f;
+
+    for(float t = 0.0f; t < duration; t += dt)
+    {
+        float measured = plant.temperature() + (noise > 0.0f ? sensor_noise(rng) : 0.0f);
+        duty = pid.update(target, measured, dt);
+        if(duty > r.max_duty) r.max_duty = duty;
+
+        for(int i = 0; i < substeps; i++)
+        {
+            plant.step(duty, SIM_STEP_S);
+        }
+
+        // Noise free values for the figures of merit
+        float error = plant.temperature() - target;
+        if(dir * error > r.overshoot) r.overshoot = dir * error;
+
+        if(std::fabs(error) > band) r.settling_s = -1.0f;
+        else if(r.settling_s < 0.0f) r.settling_s = t + dt;
+
+        if(trace) fprintf(trace, "%.1f,%.4f,%.4f\n", t + dt, plant.temperature(), duty);
+    }
+
+    r.final_error = plant.temperature() - target;
+    return r;
+}
+
+int main(int argc, char** argv)
+{
+    PIDGains gains = { TEMP_DEFAULT_KP, TEMP_DEFAULT_KI, TEMP_DEFAULT_KD, TEMP_DEFAULT_TAU_D };
+    float target = 15.0f;
+    float duration = 1800.0f;
+    float noise = 0.02f;
+    float band = 0.1f;
+    float max_overshoot = 0.1f;
+    float max_settling = 0.0f;
+    int rule = -1;
+    const char* out_path = nullptr;
+    const char* trace_path = nullptr;
+
+    const SimOption Options[] = {
+        { "--target",        SIM_OPT_FLOAT, &target,        "C" },
+        { "--duration",      SIM_OPT_FLOAT, &duration,      "s" },
+        { "--kp",            SIM_OPT_FLOAT, &gains.kp,      "K" },
+        { "--ki",            SIM_OPT_FLOAT, &gains.ki,      "K" },
+        { "--kd",            SIM_OPT_FLOAT, &gains.kd,      "K" },
+        { "--tau",           SIM_OPT_FLOAT, &gains.tau_d,   "s" },
+        { "--autotune",      SIM_OPT_INT,   &rule,          "RULE" },
+        { "--noise",         SIM_OPT_FLOAT, &noise,         "C" },
+        { "--band",          SIM_OPT_FLOAT, &band,          "C" },
+        { "--max-overshoot", SIM_OPT_FLOAT, &max_overshoot, "C" },
+        { "--max-settling",  SIM_OPT_FLOAT, &max_settling,  "s" },
+        { "--out",           SIM_OPT_TEXT,  &out_path,      "FILE" },
+        { "--trace",         SIM_OPT_TEXT,  &trace_path,    "FILE" }
+    };
+    if(!simParseArgs(argc, argv, Options))
+        return SIM_EXIT_USAGE;
+
+    if(duration <= 0.0f || band <= 0.0f || noise < 0.0f || rule > TUNE_TYREUS_LUYBEN)
+    {
+        fprintf(stderr, "--duration and --band must be positive, --noise can not be negative, --autotune takes 0 to 2\n");
+        return SIM_EXIT_USAGE;
+    }
+
+    RelayAutotune tuner(TEMP_OUT_MIN, TEMP_OUT_MAX);
+    float tune_s = 0.0f;
+    if(rule >= 0)
+    {
+        if(!autotune((TuningRule)rule, target, noise, tuner, tune_s))
+        {
+            fprintf(stderr, "Autotune failed after %.0f s\n", tune_s);
+            return SIM_EXIT_FAILED;
+        }
+        gains = tuner.getGains();
+    }
+
+    FILE* out = simOpenOutput(out_path);
+    FILE* trace = trace_path ? fopen(trace_path, "w") : nullptr;
+    if(!out || (trace_path && !trace))
+    {
+        if(out) perror(trace_path);
+        return SIM_EXIT_USAGE;
+    }
+    if(trace) fprintf(trace, "t,temperature,duty\n");
+
+    StepResult r = run(gains, target, duration, noise, band, trace);
+    bool failed = r.settling_s < 0.0f || r.overshoot > max_overshoot || (max_settling > 0.0f && r.settling_s > max_settling);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"benchmark\": \"peltier_step\",\n");
+    if(rule >= 0)
+    {
+        fprintf(out, "  \"autotune\": { \"rule\": %d, \"ku\": %g, \"tu\": %g, \"duration_s\": %.1f },\n",
+                rule, tuner.getUltimateGain(), tuner.getUltimatePeriod(), tune_s);
+    }
+    fprintf(out, "  \"gains\": { \"kp\": %g, \"ki\": %g, \"kd\": %g, \"tau_d\": %g },\n", gains.kp, gains.ki, gains.kd, gains.tau_d);
+    fprintf(out, "  \"start\": %.2f,\n", DefaultThermal.t_amb);
+    fprintf(out, "  \"target\": %.2f,\n", target);
+    fprintf(out, "  \"settling_s\": %.1f,\n", r.settling_s);
+    fprintf(out, "  \"overshoot\": %.3f,\n", r.overshoot);
+    fprintf(out, "  \"final_error\": %.3f,\n", r.final_error);
+    fprintf(out, "  \"max_duty\": %.3f\n", r.max_duty);
+    fprintf(out, "}\n");
+    if(trace) fclose(trace);
+
+    return simFinish(out, failed, "Loop did not settle (within %.0f s or --max-settling) or overshot by more than %.2f C", duration, max_overshoot);
+}